@@ -0,0 +1,150 @@
+#pragma once
+
+/*
+ * tiny benchmark harness: wall time, heap allocations and retired
+ * instructions per transition around a callable.
+ *
+ * it replaces the global operator new/delete to count allocations, so it
+ * must be included by exactly one translation unit per benchmark binary.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace bench {
+
+inline std::atomic<std::size_t> allocations{0};
+
+// retired user-space instructions via perf_event_open, when the kernel lets us
+class instruction_counter {
+public:
+    instruction_counter() {
+#ifdef __linux__
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.type           = PERF_TYPE_HARDWARE;
+        attr.size           = sizeof(attr);
+        attr.config         = PERF_COUNT_HW_INSTRUCTIONS;
+        attr.disabled       = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv     = 1;
+        m_fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+#endif
+    }
+
+    ~instruction_counter() {
+#ifdef __linux__
+        if (m_fd >= 0) {
+            close(m_fd);
+        }
+#endif
+    }
+
+    instruction_counter(const instruction_counter &) = delete;
+    instruction_counter &operator=(const instruction_counter &) = delete;
+
+    bool available() const { return m_fd >= 0; }
+
+    void start() {
+#ifdef __linux__
+        if (m_fd >= 0) {
+            ioctl(m_fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(m_fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+    }
+
+    long long stop() {
+        long long count = 0;
+#ifdef __linux__
+        if (m_fd >= 0) {
+            ioctl(m_fd, PERF_EVENT_IOC_DISABLE, 0);
+            if (read(m_fd, &count, sizeof(count)) != sizeof(count)) {
+                count = 0;
+            }
+        }
+#endif
+        return count;
+    }
+
+private:
+    int m_fd = -1;
+};
+
+struct result {
+    double ns;
+    double allocs;
+    double instructions;    // < 0 if the counter is not available
+};
+
+/*
+ * runs f() once, which must perform `transitions` transitions, and prints
+ * one line of per-transition figures
+ */
+template <typename F>
+result measure(const char *name, long transitions, F && f) {
+    static instruction_counter counter;
+
+    const std::size_t allocs_before = allocations.load(std::memory_order_relaxed);
+    counter.start();
+    auto begin = std::chrono::steady_clock::now();
+
+    f();
+
+    auto end = std::chrono::steady_clock::now();
+    const long long instructions = counter.stop();
+    const std::size_t allocs = allocations.load(std::memory_order_relaxed) - allocs_before;
+
+    result r;
+    r.ns           = std::chrono::duration<double, std::nano>(end - begin).count() / transitions;
+    r.allocs       = double(allocs) / transitions;
+    r.instructions = counter.available() ? double(instructions) / transitions : -1.0;
+
+    if (r.instructions >= 0) {
+        printf("%-36s %9.2f ns/tr %8.3f allocs/tr %9.1f instr/tr\n", name, r.ns, r.allocs, r.instructions);
+    } else {
+        printf("%-36s %9.2f ns/tr %8.3f allocs/tr %9s instr/tr\n", name, r.ns, r.allocs, "n/a");
+    }
+    return r;
+}
+
+} // namespace bench
+
+
+void *operator new(std::size_t size) {
+    bench::allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void *p = std::malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+// once both are inlined into a caller gcc sees malloc paired with the
+// free below and warns, though that is exactly this operator new's pair
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void operator delete(void *p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept {
+    std::free(p);
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
@@ -0,0 +1,75 @@
+/*
+ * compile-time benchmark: a generated table of ROWS transitions over
+ * ROWS / 2 states and two events, each state with one row per event. the
+ * Makefile's compile-bench target builds it for 10, 100 and 1000 rows and
+ * reports compiler time and peak memory; the binary itself does nothing.
+ *
+ *   types     the state and event sets and the dense lookup table, what
+ *             every machine over the table computes
+ *   machine   (-DFULL_MACHINE) also a started state_machine, instantiating
+ *             its std::variant of states and dispatch for every state. a
+ *             variant of 500 states needs a -ftemplate-depth above 900
+ */
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+#include <variant>
+
+#include "fsm.hpp"
+
+#ifndef ROWS
+#define ROWS 100
+#endif
+
+template <int I>
+struct st {
+    st(bool &) {}
+
+    template <typename Callable>
+    void operator()(Callable &&) {}
+
+    template <typename Event, typename Callable>
+    void operator()(Event, Callable &&) {}
+};
+
+template <int I>
+struct ev {};
+
+// row I leaves state I / 2 on event I % 2, for the next state or the one after
+template <int I, int States>
+using row = transition<st<I / 2>, ev<I % 2>, st<(I / 2 + 1 + I % 2) % States>>;
+
+template <typename Is>
+struct generated_table;
+
+template <int ... Is>
+struct generated_table<std::integer_sequence<int, Is...>> {
+    using type = std::variant<row<Is, int(sizeof...(Is)) / 2>...>;
+};
+
+using table = generated_table<std::make_integer_sequence<int, ROWS>>::type;
+
+// what state_machine computes from its table, without instantiating the
+// machine and with it a std::variant of every state
+using flat   = flatten_table_t<table>;
+using states = remove_duplicates_t<extract_lists<flat>::states>;
+using events = remove_duplicates_t<extract_lists<flat>::events>;
+using lookup = transition_lookup<flat, states, events>;
+
+static_assert(size_of_v<states> == ROWS / 2, "every state once");
+static_assert(size_of_v<events> == 2, "every event once");
+static_assert(lookup::find<st<ROWS / 2 - 1>, ev<1>>() == ROWS - 1, "last row");
+
+int main(int, char **) {
+#ifdef FULL_MACHINE
+    using machine = state_machine<table>;
+    static_assert(std::is_same_v<machine::states, states>, "the same state set");
+
+    struct driven : machine {
+        using machine::push;
+    } fsm;
+    fsm.start<st<0>>();
+    fsm.push(ev<0>{});
+#endif
+    return 0;
+}
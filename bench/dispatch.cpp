@@ -0,0 +1,84 @@
+/*
+ * micro-benchmark: ns/transition of the dispatch backends.
+ *
+ * a ring of Ring states, each forwarding a step event to its successor
+ * until the budget in the context runs out. the machine runs to completion,
+ * so the whole run is one flat drain loop and the numbers are pure dispatch
+ * + state construction cost.
+ */
+#include <chrono>
+#include <cstdio>
+#include <utility>
+#include <variant>
+
+#include "fsm.hpp"
+
+struct step {};
+
+struct budget {
+    long remaining;
+};
+
+template <int N>
+struct node {
+    node(budget *b) : m_budget(b) {}
+
+    template <typename Callable>
+    void operator()(Callable && cb) {
+        cb(step{});
+    }
+
+    template <typename Callable>
+    void operator()(step, Callable && cb) {
+        if (--m_budget->remaining > 0) {
+            cb(step{});
+        }
+    }
+
+    budget *m_budget;
+};
+
+template <int Ring, typename Is = std::make_integer_sequence<int, Ring>>
+struct ring_table;
+
+template <int Ring, int ... Is>
+struct ring_table<Ring, std::integer_sequence<int, Is...>> {
+    using type = std::variant<transition<node<Is>, step, node<(Is + 1) % Ring>>...>;
+};
+
+template <typename Dispatch>
+struct bench_policy : default_policy {
+    static constexpr std::size_t queue_capacity = 2;
+    using dispatch = Dispatch;
+};
+
+template <int Ring, typename Dispatch>
+double run(const char *name, long transitions) {
+    using machine = state_machine<typename ring_table<Ring>::type, budget *, bench_policy<Dispatch>>;
+
+    budget b{transitions};
+    machine fsm(&b);
+
+    auto begin = std::chrono::steady_clock::now();
+    fsm.template start<node<0>>();
+    auto end = std::chrono::steady_clock::now();
+
+    double ns = std::chrono::duration<double, std::nano>(end - begin).count() / transitions;
+    printf("%-8s %3d states  %8.2f ns/transition\n", name, Ring, ns);
+    return ns;
+}
+
+template <int Ring>
+void run_all(long transitions) {
+    run<Ring, visit_dispatch>("visit", transitions);
+    run<Ring, switch_dispatch>("switch", transitions);
+    run<Ring, table_dispatch>("table", transitions);
+}
+
+int main(int, char **) {
+    const long transitions = 20000000;
+
+    run_all<2>(transitions);
+    run_all<8>(transitions);
+    run_all<32>(transitions);
+}
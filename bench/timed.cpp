@@ -0,0 +1,49 @@
+/*
+ * runs a command and prints its wall time and peak resident memory, the
+ * part of time(1) compile-bench needs, without depending on it:
+ *
+ *   bench/timed <label> <command> [args...]
+ */
+#include <chrono>
+#include <cstdio>
+
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        std::fprintf(stderr, "usage: %s <label> <command> [args...]\n", argv[0]);
+        return 2;
+    }
+
+    const auto begin = std::chrono::steady_clock::now();
+    const pid_t pid = fork();
+    if (pid < 0) {
+        std::perror("fork");
+        return 2;
+    }
+    if (pid == 0) {
+        execvp(argv[2], argv + 2);
+        std::perror(argv[2]);
+        _exit(127);
+    }
+
+    int status = 0;
+    rusage usage{};
+    if (wait4(pid, &status, 0, &usage) < 0) {
+        std::perror("wait4");
+        return 2;
+    }
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin;
+
+    // ru_maxrss is in kilobytes on linux, in bytes on macos
+#ifdef __APPLE__
+    const long peak_kb = usage.ru_maxrss / 1024;
+#else
+    const long peak_kb = usage.ru_maxrss;
+#endif
+    std::printf("%-32s %8.2f s %10ld KB\n", argv[1], elapsed.count(), peak_kb);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+}
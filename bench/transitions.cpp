@@ -0,0 +1,695 @@
+/*
+ * transition throughput suite: ns, heap allocations and instructions per
+ * transition for the shapes of table we run in production.
+ *
+ *   ping-pong      two states bouncing one event, also with metrics_trace
+ *                  and journal_trace
+ *   linear chain   64 states entered once each, restarted from the head
+ *   wide table     32 states x 4 events = 128 transitions
+ *   heavy payload  a 64 byte std::string carried by every event, from the
+ *                  heap and from a per-machine transition_arena
+ *   move-only      a std::unique_ptr<frame> moved from state to state
+ *   instances      10k machines, one external event each per round, as
+ *                  separate state_machines and as one machine_pool broadcast,
+ *                  and with a rarely entered 1k state stored inline or,
+ *                  with compact_storage, out of line
+ *   dfa            the same 10k as index-only machines in a dfa_pool, and
+ *                  10k wide table machines each given its own event
+ *   failure storm  10k machines failing at once, error_event vs the
+ *                  std::runtime_error the demo used to emit
+ *   migration      100k sessions written to one buffer with snapshot() and
+ *                  restored into other machines, per session
+ *   guarded stay   an event that should leave the state alone, as a self
+ *                  transition rebuilding a 256 byte state vs a guard, and
+ *                  the guard fed 64 events at a time with push_batch
+ *   timeouts       1M pending timer_wheel entries re-armed, and 10k
+ *                  machines arming a timeout on entry that advance() fires
+ */
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "fsm.hpp"
+#include "fsm_pool.hpp"
+#include "fsm_dfa.hpp"
+#include "fsm_metrics.hpp"
+#include "fsm_journal.hpp"
+#include "fsm_timer.hpp"
+#include "bench.hpp"
+
+struct budget {
+    long remaining;
+};
+
+struct bench_policy : default_policy {
+    static constexpr std::size_t queue_capacity = 2;
+};
+
+// exposes push() so the benchmark can feed machines from outside
+template <typename Machine>
+struct driver : Machine {
+    using Machine::Machine;
+    using Machine::push;
+    using Machine::push_batch;
+};
+
+
+/*
+ * ping-pong
+ */
+struct ball {};
+
+struct ping {
+    ping(budget *b) : m_budget(b) {}
+
+    template <typename Callable>
+    void operator()(Callable && cb) { cb(ball{}); }
+
+    template <typename Callable>
+    void operator()(ball, Callable && cb) {
+        if (--m_budget->remaining > 0) {
+            cb(ball{});
+        }
+    }
+
+    budget *m_budget;
+};
+
+struct pong : ping {
+    using ping::ping;
+};
+
+using ping_pong_table = std::variant<
+    transition<ping, ball, pong>,
+    transition<pong, ball, ping>
+>;
+
+struct metrics_policy : bench_policy {
+    using trace = metrics_trace<ping_pong_table>;
+};
+
+struct counts_policy : bench_policy {
+    using trace = metrics_trace<ping_pong_table, false>;
+};
+
+struct journal_policy : bench_policy {
+    using trace = journal_trace<ping_pong_table>;
+};
+
+
+/*
+ * linear chain
+ */
+struct next {};
+
+template <int N>
+struct chain_link {
+    chain_link(budget *) {}
+
+    template <typename Callable>
+    void operator()(Callable && cb) { cb(next{}); }
+
+    template <typename Callable>
+    void operator()(next, Callable && cb) {
+        if constexpr (N + 1 < 64) {
+            cb(next{});
+        }
+    }
+};
+
+template <typename Is = std::make_integer_sequence<int, 63>>
+struct chain_table;
+
+template <int ... Is>
+struct chain_table<std::integer_sequence<int, Is...>> {
+    using type = std::variant<transition<chain_link<Is>, next, chain_link<Is + 1>>...>;
+};
+
+
+/*
+ * wide table
+ */
+template <int K>
+struct pulse {};
+
+template <int N>
+struct cell {
+    cell(budget *b) : m_budget(b) {}
+
+    template <typename Callable>
+    void operator()(Callable && cb) { cb(pulse<0>{}); }
+
+    template <int K, typename Callable>
+    void operator()(pulse<K>, Callable && cb) {
+        const long left = --m_budget->remaining;
+        switch (left & 3) {
+        case 0: if (left > 0) cb(pulse<0>{}); break;
+        case 1: cb(pulse<1>{}); break;
+        case 2: cb(pulse<2>{}); break;
+        case 3: cb(pulse<3>{}); break;
+        }
+    }
+
+    budget *m_budget;
+};
+
+template <int I, int K>
+using wide_row = transition<cell<I>, pulse<K>, cell<(I * 5 + K + 1) % 32>>;
+
+template <typename Is = std::make_integer_sequence<int, 32>>
+struct wide_table;
+
+template <int ... Is>
+struct wide_table<std::integer_sequence<int, Is...>> {
+    using type = std::variant<wide_row<Is, 0>..., wide_row<Is, 1>..., wide_row<Is, 2>..., wide_row<Is, 3>...>;
+};
+
+
+/*
+ * heavy payload
+ */
+template <typename T = std::string>
+struct success {
+    T value;
+};
+
+struct sender {
+    sender(budget *b) : m_budget(b) {}
+
+    template <typename Callable>
+    void operator()(Callable && cb) {
+        cb(success<>{std::string(64, 'x')});
+    }
+
+    template <typename Callable>
+    void operator()(success<> s, Callable && cb) {
+        if (--m_budget->remaining > 0) {
+            cb(s);
+        }
+    }
+
+    budget *m_budget;
+};
+
+struct receiver : sender {
+    using sender::sender;
+};
+
+using payload_table = std::variant<
+    transition<sender,   success<>, receiver>,
+    transition<receiver, success<>, sender>
+>;
+
+// the same, with the string bump-allocated from the machine's arena
+using arena_string = std::basic_string<char, std::char_traits<char>, arena_allocator<char>>;
+
+struct arena_sender {
+    arena_sender(budget *b, monotonic_arena &arena) : m_budget(b), m_arena(arena) {}
+
+    template <typename Callable>
+    void operator()(Callable && cb) {
+        cb(success<arena_string>{arena_string(64, 'x', m_arena)});
+    }
+
+    template <typename Callable>
+    void operator()(success<arena_string> s, Callable && cb) {
+        if (--m_budget->remaining > 0) {
+            cb(success<arena_string>{arena_string(s.value, m_arena)});
+        }
+    }
+
+    budget *m_budget;
+    monotonic_arena &m_arena;
+};
+
+struct arena_receiver : arena_sender {
+    using arena_sender::arena_sender;
+};
+
+using arena_payload_table = std::variant<
+    transition<arena_sender,   success<arena_string>, arena_receiver>,
+    transition<arena_receiver, success<arena_string>, arena_sender>
+>;
+
+struct arena_policy : bench_policy {
+    using arena = transition_arena<1024>;
+};
+
+
+/*
+ * many instances: each external push is one transition, nothing re-emitted
+ */
+struct tick {};
+
+struct idle {
+    idle(budget *) {}
+
+    template <typename Callable>
+    void operator()(Callable &&) {}
+
+    template <typename Callable>
+    void operator()(tick, Callable &&) {}
+};
+
+struct busy : idle {
+    using idle::idle;
+};
+
+using instance_table = std::variant<
+    transition<idle, tick, busy>,
+    transition<busy, tick, idle>
+>;
+
+struct flush {};
+
+struct draining : idle {
+    using idle::idle;
+    using idle::operator();
+
+    template <typename Callable>
+    void operator()(flush, Callable &&) {}
+
+    unsigned char m_buffer[1024];
+};
+
+using sparse_instance_table = std::variant<
+    transition<idle,     tick,  busy>,
+    transition<busy,     tick,  idle>,
+    transition<busy,     flush, draining>,
+    transition<draining, tick,  idle>
+>;
+
+struct compact_policy : bench_policy {
+    using storage = compact_storage<64>;
+};
+
+
+/*
+ * move-only payload: one received frame handed on, never copied
+ */
+struct frame {
+    unsigned char bytes[1500];
+};
+
+using frame_ptr = std::unique_ptr<frame>;
+
+struct rx {
+    rx(budget *b) : m_budget(b) {}
+
+    template <typename Callable>
+    void operator()(Callable && cb) { cb(std::make_unique<frame>()); }
+
+    template <typename Callable>
+    void operator()(frame_ptr f, Callable && cb) {
+        if (--m_budget->remaining > 0) {
+            cb(std::move(f));
+        }
+    }
+
+    budget *m_budget;
+};
+
+struct tx : rx {
+    using rx::rx;
+};
+
+using frame_table = std::variant<
+    transition<rx, frame_ptr, tx>,
+    transition<tx, frame_ptr, rx>
+>;
+
+
+/*
+ * failure storm: a fresh error per failing session, as the network would
+ */
+template <typename Error>
+struct session {
+    session(budget *) {}
+
+    template <typename Callable>
+    void operator()(Callable &&) {}
+
+    template <typename Callable>
+    void operator()(const Error &, Callable &&) {}
+};
+
+template <typename Error>
+struct broken : session<Error> {
+    using session<Error>::session;
+};
+
+template <typename Error>
+using storm_table = std::variant<
+    transition<session<Error>, Error, broken<Error>>,
+    transition<broken<Error>,  Error, session<Error>>
+>;
+
+template <typename Error, typename MakeError>
+void run_storm(const char *name, MakeError make_error) {
+    const long machines = 10000;
+    const long rounds   = 200;
+    using machine = driver<state_machine<storm_table<Error>, budget *, bench_policy>>;
+
+    std::vector<machine> fsms(machines);
+    for (auto &fsm : fsms) {
+        fsm.template start<session<Error>>();
+    }
+    bench::measure(name, machines * rounds, [&] {
+        for (long r = 0; r < rounds; ++r) {
+            for (auto &fsm : fsms) {
+                fsm.push(make_error());
+            }
+        }
+    });
+}
+
+
+/*
+ * guarded stay: samples below the limit must not change state
+ */
+struct sample {
+    int value;
+};
+
+struct monitoring {
+    monitoring(budget *) { std::memset(m_window, 0, sizeof(m_window)); }
+
+    template <typename Callable>
+    void operator()(Callable &&) {}
+
+    template <typename Callable>
+    void operator()(sample s, Callable &&) { m_window[s.value & 0xff] = 1; }
+
+    unsigned char m_window[256];
+};
+
+struct alarming : monitoring {
+    using monitoring::monitoring;
+};
+
+struct over_limit {
+    bool operator()(const monitoring &, const sample &s) const { return s.value > 1000; }
+};
+
+using self_stay_table = std::variant<
+    transition<monitoring, sample, monitoring>,
+    transition<alarming,   sample, monitoring>
+>;
+
+using guarded_stay_table = std::variant<
+    transition<monitoring, sample, alarming, over_limit>,
+    transition<alarming,   sample, monitoring>
+>;
+
+template <typename Table>
+void run_stay(const char *name) {
+    const long events = 20000000;
+    driver<state_machine<Table, budget *, bench_policy>> fsm;
+    fsm.template start<monitoring>();
+    bench::measure(name, events, [&] {
+        for (long i = 0; i < events; ++i) {
+            fsm.push(sample{int(i & 0x3ff)});
+        }
+    });
+}
+
+// the same events as run_stay, 64 at a time as if from one socket read
+template <typename Table>
+void run_stay_batch(const char *name) {
+    using machine = driver<state_machine<Table, budget *, bench_policy>>;
+    const long events = 20000000;
+    const std::size_t burst = 64;
+    machine fsm;
+    fsm.template start<monitoring>();
+    std::vector<typename machine::events> batch(burst);
+    bench::measure(name, events, [&] {
+        for (long i = 0; i < events; i += burst) {
+            for (std::size_t j = 0; j < burst; ++j) {
+                batch[j] = sample{int((i + j) & 0x3ff)};
+            }
+            fsm.push_batch(batch.data(), burst);
+        }
+    });
+}
+
+
+/*
+ * migration: sessions with a small trivially copyable payload
+ */
+struct resumable {
+    struct snapshot_type {
+        std::uint64_t seq;
+        std::uint32_t window;
+    };
+
+    resumable(budget *) {}
+    resumable(budget *, const snapshot_type &s) : m_seq(s.seq), m_window(s.window) {}
+
+    snapshot_type snapshot() const { return {m_seq, m_window}; }
+
+    template <typename Callable>
+    void operator()(Callable &&) {}
+
+    template <typename Callable>
+    void operator()(tick, Callable &&) { ++m_seq; }
+
+    std::uint64_t m_seq = 0;
+    std::uint32_t m_window = 64;
+};
+
+struct draining_session : resumable {
+    using resumable::resumable;
+};
+
+using migration_table = std::variant<
+    transition<resumable,        tick, draining_session>,
+    transition<draining_session, tick, resumable>
+>;
+
+
+/*
+ * timeouts: every state arms a timeout on entry, the timeout leaves it
+ */
+struct expired {};
+
+struct waiting {
+    waiting(timer_context<> &ctx) : m_timeout(ctx.timers()) {}
+
+    template <typename Callable>
+    void operator()(Callable && cb) {
+        m_timeout.arm(std::chrono::milliseconds(1), cb, expired{});
+    }
+
+    template <typename Callable>
+    void operator()(expired, Callable && cb) {
+        m_timeout.arm(std::chrono::milliseconds(1), cb, expired{});
+    }
+
+    fsm_timer<> m_timeout;
+};
+
+struct retrying : waiting {
+    using waiting::waiting;
+};
+
+using timeout_table = std::variant<
+    transition<waiting,  expired, retrying>,
+    transition<retrying, expired, waiting>
+>;
+
+
+template <typename Table, typename Policy = bench_policy>
+void run_instances(const char *name) {
+    const long machines = 10000;
+    const long rounds   = 1000;
+    using machine = driver<state_machine<Table, budget *, Policy>>;
+
+    std::vector<machine> fsms(machines);
+    for (auto &fsm : fsms) {
+        fsm.template start<idle>();
+    }
+    bench::measure(name, machines * rounds, [&] {
+        for (long r = 0; r < rounds; ++r) {
+            for (auto &fsm : fsms) {
+                fsm.push(tick{});
+            }
+        }
+    });
+}
+
+
+template <typename Table, typename StartState, typename Policy = bench_policy>
+void run_budget(const char *name, long transitions) {
+    budget b{transitions};
+    state_machine<Table, budget *, Policy> fsm(&b);
+    bench::measure(name, transitions, [&] {
+        fsm.template start<StartState>();
+    });
+}
+
+int main(int, char **) {
+    run_budget<ping_pong_table, ping>("ping-pong", 20000000);
+    run_budget<ping_pong_table, ping, metrics_policy>("ping-pong (metrics)", 20000000);
+    run_budget<ping_pong_table, ping, counts_policy>("ping-pong (metrics, counts only)", 20000000);
+
+    if (std::FILE *journal_file = std::tmpfile()) {
+        journal_options opts;
+        opts.wait_when_full = true;
+        journal::open(journal_file, opts);
+        run_budget<ping_pong_table, ping, journal_policy>("ping-pong (journal)", 5000000);
+        journal::close();
+        std::fclose(journal_file);
+    }
+
+    {
+        const long runs = 200000;
+        budget b{0};
+        state_machine<chain_table<>::type, budget *, bench_policy> fsm(&b);
+        bench::measure("linear chain (64 states)", runs * 63, [&] {
+            for (long i = 0; i < runs; ++i) {
+                fsm.start<chain_link<0>>();
+            }
+        });
+    }
+
+    run_budget<wide_table<>::type, cell<0>>("wide table (128 transitions)", 20000000);
+    run_budget<payload_table, sender>("heavy payload (success<string>)", 5000000);
+    run_budget<arena_payload_table, arena_sender, arena_policy>("heavy payload (arena string)", 5000000);
+    run_budget<frame_table, rx>("move-only (unique_ptr<frame>)", 20000000);
+
+    run_instances<instance_table>("instances (10k machines)");
+    run_instances<sparse_instance_table>("instances (10k, 1k state inline)");
+    run_instances<sparse_instance_table, compact_policy>("instances (10k, 1k state out of line)");
+
+    {
+        const long machines = 10000;
+        const long rounds   = 1000;
+
+        machine_pool<instance_table, budget *, bench_policy> pool(machines);
+        for (long i = 0; i < machines; ++i) {
+            pool.start<idle>();
+        }
+        bench::measure("instances (10k pooled, broadcast)", machines * rounds, [&] {
+            for (long r = 0; r < rounds; ++r) {
+                pool.broadcast(tick{});
+            }
+        });
+    }
+
+    {
+        const long machines = 10000;
+        const long rounds   = 10000;
+
+        dfa_pool<instance_table> pool(machines);
+        pool.start_all<idle>();
+        bench::measure("dfa (10k pooled, broadcast)", machines * rounds, [&] {
+            for (long r = 0; r < rounds; ++r) {
+                pool.broadcast(tick{});
+            }
+        });
+    }
+
+    {
+        using pool_type = dfa_pool<wide_table<>::type>;
+        const long machines = 10000;
+        const long rounds   = 10000;
+        const long streams  = 16;
+
+        // a few rounds of random events, cycled through so none are generated while timed
+        std::vector<pool_type::event_type> events(machines * streams);
+        std::uint32_t x = 2463534242u;
+        for (auto &e : events) {
+            x ^= x << 13;
+            x ^= x >> 17;
+            x ^= x << 5;
+            e = pool_type::event_type(x % pool_type::table::event_count);
+        }
+
+        pool_type pool(machines);
+        pool.start_all<cell<0>>();
+        bench::measure("dfa (10k pooled, per-machine events)", machines * rounds, [&] {
+            for (long r = 0; r < rounds; ++r) {
+                pool.step(&events[(r % streams) * machines]);
+            }
+        });
+    }
+
+    run_storm<error_event>("failure storm (error_event)", [] {
+        return error_event(std::errc::connection_reset, "remote disconnect");
+    });
+    run_storm<std::runtime_error>("failure storm (runtime_error)", [] {
+        return std::runtime_error("remote disconnect");
+    });
+
+    {
+        const long sessions = 100000;
+        const long rounds   = 20;
+        using machine = driver<state_machine<migration_table, budget *, bench_policy>>;
+        constexpr std::size_t record = machine::snapshot_size;
+
+        std::vector<machine> from(sessions), to(sessions);
+        for (auto &fsm : from) {
+            fsm.start<resumable>();
+            fsm.push(tick{});
+        }
+        std::unique_ptr<unsigned char[]> buffer(new unsigned char[sessions * record]);
+        bench::measure("migration (100k snapshot + restore)", sessions * rounds, [&] {
+            for (long r = 0; r < rounds; ++r) {
+                for (long i = 0; i < sessions; ++i) {
+                    from[i].snapshot(&buffer[i * record], record);
+                }
+                for (long i = 0; i < sessions; ++i) {
+                    to[i].restore(&buffer[i * record], record);
+                }
+            }
+        });
+    }
+
+    run_stay<self_stay_table>("guarded stay (self transition)");
+    run_stay<guarded_stay_table>("guarded stay (guard)");
+    run_stay_batch<guarded_stay_table>("guarded stay (guard, push_batch)");
+
+    {
+        const long entries = 1000000;
+        const long rounds  = 4;
+        std::unique_ptr<wheel_entry[]> pending(new wheel_entry[entries]);
+        timer_wheel wheel;
+        for (long i = 0; i < entries; ++i) {
+            pending[i].on_expiry = [](wheel_entry &) {};
+            wheel.schedule(pending[i], std::chrono::milliseconds(1 + i % 3600000));
+        }
+        bench::measure("timeouts (1M pending, re-arm)", entries * rounds, [&] {
+            for (long r = 0; r < rounds; ++r) {
+                for (long i = 0; i < entries; ++i) {
+                    wheel.schedule(pending[i], std::chrono::milliseconds(1 + (i * 7919 + r) % 3600000));
+                }
+            }
+        });
+    }
+
+    {
+        const long machines = 10000;
+        const long rounds   = 1000;
+        const auto t0 = timer_wheel::clock::now();
+        timer_wheel wheel(std::chrono::milliseconds(1), t0);
+        using machine = state_machine<timeout_table, timer_context<>, bench_policy>;
+
+        std::deque<machine> fsms;
+        for (long i = 0; i < machines; ++i) {
+            fsms.emplace_back(timer_context<>(wheel));
+            fsms.back().start<waiting>();
+        }
+        bench::measure("timeouts (10k machines, advance)", machines * rounds, [&] {
+            for (long r = 1; r <= rounds; ++r) {
+                wheel.advance(t0 + std::chrono::milliseconds(r));
+            }
+        });
+    }
+}
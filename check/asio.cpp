@@ -0,0 +1,96 @@
+/*
+ * asio_machine: events posted from many threads and completions handed to
+ * wrap() all run on the machine's strand, none is lost, while four
+ * threads run the io_context. only built when <asio.hpp> is found.
+ */
+#include <cassert>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+#include "fsm_asio.hpp"
+
+constexpr int posters = 4;
+constexpr int per_poster = 1000;
+
+struct go {};
+struct tick {};
+
+struct counts {
+    int ticks = 0;
+};
+
+using context = asio_context<counts>;
+
+struct idle {
+    idle(context &) {}
+
+    template <typename Callable>
+    void operator()(Callable &&) {}
+};
+
+// completes an asynchronous operation of its own with a tick
+struct waiting {
+    waiting(context &ctx) : m_ctx(&ctx) {}
+
+    template <typename Callable>
+    void operator()(go, Callable && cb) {
+        asio::post(m_ctx->wrap([cb]() mutable {
+            cb(tick{});
+        }));
+    }
+
+    context *m_ctx;
+};
+
+struct counting {
+    counting(context &ctx) : m_ctx(&ctx) {}
+
+    template <typename Callable>
+    void operator()(tick, Callable &&) {
+        assert(m_ctx->get_executor().running_in_this_thread());
+        ++m_ctx->ticks;
+    }
+
+    context *m_ctx;
+};
+
+using table = std::variant<
+    transition<idle, go, waiting>,
+    transition<waiting, tick, counting>,
+    transition<counting, tick, counting>
+>;
+
+int main() {
+    asio::io_context io;
+    auto work = asio::make_work_guard(io);
+    asio_machine<table, counts> fsm(io);
+
+    // queued on the strand ahead of every tick
+    fsm.start<idle>();
+    fsm.post(go{});
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; ++i) {
+        threads.emplace_back([&io] { io.run(); });
+    }
+    std::vector<std::thread> producers;
+    for (int p = 0; p < posters; ++p) {
+        producers.emplace_back([&fsm] {
+            for (int i = 0; i < per_poster; ++i) {
+                fsm.post(tick{});
+            }
+        });
+    }
+    for (auto &t : producers) {
+        t.join();
+    }
+    work.reset();
+    for (auto &t : threads) {
+        t.join();
+    }
+
+    assert(fsm.context().ticks == posters * per_poster + 1);
+    printf("asio: ok\n");
+    return 0;
+}
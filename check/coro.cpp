@@ -0,0 +1,200 @@
+/*
+ * coroutine states (C++20): a body that waits for an event is resumed by
+ * it through accept(), its co_return takes the transition, and an event it
+ * does not wait for leaves through the table and frees the frame. frames
+ * come from the context's arena, recursive and run-to-completion alike, and
+ * a move-only co_return value is moved, not copied, into the next state.
+ * run to completion, an event emitted for the body waits behind the one
+ * that enters its state, though no row lists it.
+ */
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <system_error>
+
+#include "fsm_coro.hpp"
+
+struct go {};
+struct abort_handshake {};
+struct done {};
+struct read_frame {};
+struct greet {};
+
+struct frame {
+    int length;
+};
+
+struct hello {
+    const char *greeting;
+};
+
+struct outcome {
+    const char *reached = "";
+    std::error_code error;
+    int frame_length = 0;
+};
+
+using context = coro_context<outcome>;
+using ctx_ref = context_ref<context>;
+
+struct idle {
+    idle(ctx_ref) {}
+
+    template <typename Callable>
+    void operator()(Callable &&) {}
+};
+
+struct handshake : coro_state<handshake, std::variant<done, error_event>> {
+    handshake(ctx_ref ctx) : coro_state(ctx->arena()) {}
+
+    task run(go) {
+        auto h = co_await next_event<hello>();
+        if (std::strcmp(h.greeting, "hello") != 0) {
+            co_return error_event(std::errc::protocol_error, "bad greeting");
+        }
+        co_return done{};
+    }
+};
+
+// enters the handshake and answers it in one go
+struct greeter {
+    greeter(ctx_ref) {}
+
+    template <typename Callable>
+    void operator()(greet, Callable && cb) {
+        cb(go{});
+        cb(hello{"hello"});
+    }
+};
+
+// waits for its greeting, then hands on a frame only it owned
+struct reading : coro_state<reading, std::unique_ptr<frame>> {
+    reading(ctx_ref ctx) : coro_state(ctx->arena()) {}
+
+    task run(read_frame) {
+        auto h = co_await next_event<hello>();
+        co_return std::make_unique<frame>(frame{int(std::strlen(h.greeting))});
+    }
+};
+
+struct framed {
+    framed(ctx_ref ctx) : m_ctx(ctx) {}
+
+    template <typename Callable>
+    void operator()(std::unique_ptr<frame> f, Callable &&) {
+        m_ctx->reached = "framed";
+        m_ctx->frame_length = f->length;
+    }
+
+    ctx_ref m_ctx;
+};
+
+struct ready {
+    ready(ctx_ref ctx) : m_ctx(ctx) {}
+
+    template <typename Callable>
+    void operator()(done, Callable &&) {
+        m_ctx->reached = "ready";
+    }
+
+    ctx_ref m_ctx;
+};
+
+struct failed {
+    failed(ctx_ref ctx) : m_ctx(ctx) {}
+
+    template <typename Callable>
+    void operator()(error_event e, Callable &&) {
+        m_ctx->reached = "failed";
+        m_ctx->error = e.code;
+    }
+
+    template <typename Callable>
+    void operator()(abort_handshake, Callable &&) {
+        m_ctx->reached = "aborted";
+    }
+
+    ctx_ref m_ctx;
+};
+
+using table = std::variant<
+    transition<idle, go, handshake>,
+    transition<handshake, done, ready>,
+    transition<handshake, error_event, failed>,
+    transition<handshake, abort_handshake, failed>,
+    transition<idle, read_frame, reading>,
+    transition<idle, greet, greeter>,
+    transition<greeter, go, handshake>,
+    transition<reading, std::unique_ptr<frame>, framed>
+>;
+
+template <std::size_t QueueCapacity>
+struct coro_policy : default_policy {
+    static constexpr bool context_by_reference = true;
+    static constexpr std::size_t queue_capacity = QueueCapacity;
+};
+
+template <typename Policy>
+class machine : public state_machine<table, context, Policy> {
+    using base = state_machine<table, context, Policy>;
+public:
+    using base::base;
+    using base::push;
+};
+
+template <typename Policy>
+void check() {
+    {
+        machine<Policy> fsm;
+        fsm.template start<idle>();
+        fsm.push(go{});
+        // suspended in co_await, its frame in the arena
+        assert(fsm.context().arena().used() > 0);
+        fsm.push(hello{"hello"});
+        assert(std::strcmp(fsm.context().reached, "ready") == 0);
+        assert(fsm.context().arena().used() == 0);
+        assert(fsm.context().arena().overflows() == 0);
+    }
+    {
+        machine<Policy> fsm;
+        fsm.template start<idle>();
+        fsm.push(go{});
+        fsm.push(hello{"bye"});
+        assert(std::strcmp(fsm.context().reached, "failed") == 0);
+        assert(fsm.context().error == std::errc::protocol_error);
+        assert(fsm.context().arena().used() == 0);
+    }
+    {
+        machine<Policy> fsm;
+        fsm.template start<idle>();
+        fsm.push(go{});
+        fsm.push(abort_handshake{});
+        assert(std::strcmp(fsm.context().reached, "aborted") == 0);
+        assert(fsm.context().arena().used() == 0);
+    }
+    {
+        machine<Policy> fsm;
+        fsm.template start<idle>();
+        fsm.push(read_frame{});
+        fsm.push(hello{"hello"});
+        assert(std::strcmp(fsm.context().reached, "framed") == 0);
+        assert(fsm.context().frame_length == 5);
+        assert(fsm.context().arena().used() == 0);
+    }
+    // recursively, the greeter would emit its hello after it is gone
+    if constexpr (Policy::queue_capacity > 0) {
+        machine<Policy> fsm;
+        fsm.template start<idle>();
+        fsm.push(greet{});
+        assert(std::strcmp(fsm.context().reached, "ready") == 0);
+        assert(fsm.context().arena().used() == 0);
+    }
+}
+
+int main() {
+    check<coro_policy<0>>();
+    check<coro_policy<4>>();
+    printf("coro: ok\n");
+    return 0;
+}
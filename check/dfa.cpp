@@ -0,0 +1,151 @@
+/*
+ * dfa_pool's broadcast() and step() against the plain definition of the
+ * table, over ring tables of 1 to 4 byte shuffle columns and one too large
+ * for shuffles. built three times by make check: with no flags for the
+ * scalar loop, with -mssse3 for the 16 wide shuffle and with -mavx2 for the
+ * 32 wide shuffle and the gathers. a vector build on a cpu without the
+ * instructions reports itself skipped.
+ */
+#include <cassert>
+#include <cstdio>
+#include <utility>
+#include <vector>
+
+#include "fsm_dfa.hpp"
+
+template <int I>
+struct node {};
+
+struct tick {};
+struct jump {};
+struct nudge {};
+
+// in no row, only node<1>'s any_event row takes it
+struct stray {};
+
+/*
+ * tick  s -> s + 1
+ * jump  s -> 7s + 3
+ * nudge node<0> -> the last node, node<1> -> node<0> through any_event,
+ *       every other node stays
+ */
+template <int N, typename Is = std::make_integer_sequence<int, N>>
+struct ring_table;
+
+template <int N, int ... Is>
+struct ring_table<N, std::integer_sequence<int, Is...>> {
+    using type = std::variant<
+        transition<node<Is>, tick, node<(Is + 1) % N>>...,
+        transition<node<Is>, jump, node<(Is * 7 + 3) % N>>...,
+        transition<node<0>, nudge, node<N - 1>>,
+        transition<node<1>, any_event, node<0>>
+    >;
+};
+
+enum kind { on_tick, on_jump, on_nudge, on_stray, kinds };
+
+int model(int n, int s, kind k) {
+    switch (k) {
+    case on_tick:  return (s + 1) % n;
+    case on_jump:  return (s * 7 + 3) % n;
+    case on_nudge: return s == 0 ? n - 1 : s == 1 ? 0 : s;
+    default:       return s == 1 ? 0 : s;
+    }
+}
+
+struct lcg {
+    unsigned next() {
+        m_state = m_state * 1103515245u + 12345u;
+        return (m_state >> 16) & 0x7fff;
+    }
+
+    unsigned m_state = 7;
+};
+
+// each node's index in the table, which orders states as it meets them
+template <typename Table, int ... Is>
+std::vector<int> indices(std::integer_sequence<int, Is...>) {
+    return {int(Table::template state_index<node<Is>>)...};
+}
+
+template <int N>
+void check() {
+    using pool_type = dfa_pool<typename ring_table<N>::type>;
+    using table = typename pool_type::table;
+    using event_type = typename table::event_type;
+    static_assert(table::state_count == N, "one state per node");
+
+    const std::vector<int> index_of = indices<table>(std::make_integer_sequence<int, N>());
+    std::vector<int> node_of(N);
+    for (int i = 0; i < N; ++i) {
+        node_of[index_of[i]] = i;
+    }
+    const event_type column[kinds] = {
+        table::template event_index<tick>, table::template event_index<jump>,
+        table::template event_index<nudge>, table::template event_index<stray>,
+    };
+
+    // not a multiple of any vector width, so the scalar tail runs too
+    constexpr std::size_t machines = 1000 + 13;
+    pool_type pool(machines);
+    pool.template start_all<node<0>>();
+    std::vector<int> expected(machines, 0);
+    lcg rng;
+
+    std::vector<event_type> events(machines);
+    for (int round = 0; round < 300; ++round) {
+        if (rng.next() % 2) {
+            const kind k = kind(rng.next() % kinds);
+            pool.broadcast_index(column[k]);
+            for (int &s : expected) {
+                s = model(N, s, k);
+            }
+        } else {
+            for (std::size_t id = 0; id < machines; ++id) {
+                const kind k = kind(rng.next() % kinds);
+                events[id] = column[k];
+                expected[id] = model(N, expected[id], k);
+            }
+            pool.step(events.data());
+        }
+        for (std::size_t id = 0; id < machines; ++id) {
+            assert(node_of[pool.state_index(id)] == expected[id]);
+        }
+    }
+
+    // a single machine takes the same path as the pool
+    dfa_machine<typename ring_table<N>::type> one;
+    one.template start<node<0>>();
+    int s = 0;
+    for (int k = 0; k < 4 * N; ++k) {
+        one.push_index(column[k % kinds]);
+        s = model(N, s, kind(k % kinds));
+        assert(node_of[one.state_index()] == s);
+    }
+}
+
+int main() {
+#if defined(__AVX2__)
+    const char *path = "avx2";
+    if (!__builtin_cpu_supports("avx2")) {
+        printf("dfa (%s): skipped, not supported by this cpu\n", path);
+        return 0;
+    }
+#elif defined(__SSSE3__)
+    const char *path = "ssse3";
+    if (!__builtin_cpu_supports("ssse3")) {
+        printf("dfa (%s): skipped, not supported by this cpu\n", path);
+        return 0;
+    }
+#else
+    const char *path = "scalar";
+#endif
+    check<5>();
+    check<16>();
+    check<17>();
+    check<40>();
+    check<64>();
+    check<65>();
+    printf("dfa (%s): ok\n", path);
+    return 0;
+}
@@ -0,0 +1,124 @@
+/*
+ * sharded_executor: posted events run on the machine they were posted to,
+ * destroy() runs what was posted before it and then deletes the machine,
+ * a full executor reuses destroyed ids, and ids past max_machines throw.
+ */
+#include <atomic>
+#include <cassert>
+#include <cstdio>
+#include <stdexcept>
+#include <thread>
+
+#include "fsm_executor.hpp"
+
+struct tick {};
+
+struct counters {
+    std::atomic<int> ticks{0};
+    std::atomic<int> ended{0};
+};
+
+// one per machine, counts itself out when the machine is deleted
+struct session {
+    session(counters *c) : m_counters(c) {}
+    session(session &&other) : m_counters(other.m_counters) { other.m_counters = nullptr; }
+    ~session() {
+        if (m_counters) {
+            m_counters->ended.fetch_add(1);
+        }
+    }
+
+    counters *m_counters;
+};
+
+struct idle {
+    idle(session &) {}
+
+    template <typename Callable>
+    void operator()(Callable &&) {}
+};
+
+struct counting {
+    counting(session &s) : m_counters(s.m_counters) {}
+
+    template <typename Callable>
+    void operator()(tick, Callable &&) {
+        m_counters->ticks.fetch_add(1);
+    }
+
+    counters *m_counters;
+};
+
+using table = std::variant<
+    transition<idle, tick, counting>,
+    transition<counting, tick, counting>
+>;
+
+using executor = sharded_executor<table, session>;
+
+template <typename Done>
+void wait_for(Done && done) {
+    while (!done()) {
+        std::this_thread::yield();
+    }
+}
+
+template <typename F>
+bool throws_out_of_range(F && f) {
+    try {
+        f();
+    } catch (const std::out_of_range &) {
+        return true;
+    }
+    return false;
+}
+
+int main() {
+    counters c;
+    {
+        executor_options opts;
+        opts.threads = 2;
+        opts.max_machines = 4;
+        executor ex(opts);
+
+        executor::machine_id ids[4];
+        for (auto &id : ids) {
+            id = ex.spawn<idle>(session(&c));
+            for (int i = 0; i < 3; ++i) {
+                assert(ex.post(id, tick{}));
+            }
+        }
+        wait_for([&] { return c.ticks.load() == 12; });
+
+        bool full = false;
+        try {
+            ex.spawn<idle>(session(&c));
+        } catch (const std::length_error &) {
+            full = true;
+        }
+        assert(full);
+        assert(c.ended.load() == 1);    // the session of the refused spawn
+
+        // events posted before the destroy still run, none after it
+        assert(ex.post(ids[1], tick{}));
+        assert(ex.destroy(ids[1]));
+        assert(!ex.destroy(ids[1]));
+        assert(!ex.post(ids[1], tick{}));
+        wait_for([&] { return c.ended.load() == 2; });
+        assert(c.ticks.load() == 13);
+
+        // the one free id goes to the next machine
+        const executor::machine_id reused = ex.spawn<idle>(session(&c));
+        assert(reused == ids[1]);
+        assert(ex.post(reused, tick{}));
+        wait_for([&] { return c.ticks.load() == 14; });
+
+        assert(throws_out_of_range([&] { ex.post(4, tick{}); }));
+        assert(throws_out_of_range([&] { ex.destroy(100); }));
+    }
+    // the machines still alive went with the executor
+    assert(c.ended.load() == 6);
+
+    printf("executor: ok\n");
+    return 0;
+}
@@ -0,0 +1,144 @@
+/*
+ * sharded_executor under contention, meant for the thread sanitizer (make
+ * tsan): posters race destroy() and respawns on the same ids while idle
+ * shards steal machines. every post that was accepted runs exactly once,
+ * and every machine spawned is deleted exactly once. some events throw,
+ * each reaches on_error and the machine keeps taking events.
+ */
+#include <atomic>
+#include <cassert>
+#include <cstdio>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "fsm_executor.hpp"
+
+struct tick {};
+struct boom {};
+
+struct counters {
+    std::atomic<long> ticks{0};
+    std::atomic<long> ended{0};
+};
+
+struct session {
+    session(counters *c) : m_counters(c) {}
+    session(session &&other) : m_counters(other.m_counters) { other.m_counters = nullptr; }
+    ~session() {
+        if (m_counters) {
+            m_counters->ended.fetch_add(1);
+        }
+    }
+
+    counters *m_counters;
+};
+
+struct idle {
+    idle(session &) {}
+
+    template <typename Callable>
+    void operator()(Callable &&) {}
+};
+
+struct counting {
+    counting(session &s) : m_counters(s.m_counters) {}
+
+    template <typename Callable>
+    void operator()(tick, Callable &&) {
+        m_counters->ticks.fetch_add(1);
+    }
+
+    template <typename Callable>
+    void operator()(boom, Callable &&) {
+        throw std::runtime_error("boom");
+    }
+
+    counters *m_counters;
+};
+
+using table = std::variant<
+    transition<idle, tick, counting>,
+    transition<counting, tick, counting>,
+    transition<idle, boom, counting>,
+    transition<counting, boom, counting>
+>;
+
+using executor = sharded_executor<table, session>;
+
+int main() {
+    counters c;
+    std::atomic<long> accepted{0};
+    std::atomic<long> thrown{0}, reported{0};
+    long spawned = 0;
+    {
+        executor_options opts;
+        opts.threads = 4;
+        opts.max_machines = 64;
+        opts.work_stealing = true;
+        opts.steal_depth = 4;
+        opts.on_error = [&reported](executor::machine_id, std::exception_ptr e) {
+            assert(e);
+            reported.fetch_add(1);
+        };
+        executor ex(opts);
+
+        // sessions that come and go, one at a time
+        for (int round = 0; round < 2000; ++round) {
+            const executor::machine_id id = ex.spawn<idle>(session(&c));
+            ++spawned;
+            for (int i = 0; i < 3; ++i) {
+                if (ex.post(id, tick{})) {
+                    accepted.fetch_add(1);
+                }
+            }
+            if (round % 4 == 0 && ex.post(id, boom{})) {
+                thrown.fetch_add(1);
+            }
+            assert(ex.destroy(id));
+        }
+
+        // posters on ids that are destroyed and reused under them
+        std::vector<std::atomic<executor::machine_id>> ids(32);
+        for (auto &id : ids) {
+            id.store(ex.spawn<idle>(session(&c)));
+            ++spawned;
+        }
+        std::atomic<bool> running{true};
+        std::vector<std::thread> posters;
+        for (int t = 0; t < 3; ++t) {
+            posters.emplace_back([&] {
+                unsigned n = 0;
+                while (running.load()) {
+                    for (auto &id : ids) {
+                        if (++n % 16 == 0) {
+                            if (ex.post(id.load(), boom{})) {
+                                thrown.fetch_add(1);
+                            }
+                        } else if (ex.post(id.load(), tick{})) {
+                            accepted.fetch_add(1);
+                        }
+                    }
+                }
+            });
+        }
+        for (int round = 0; round < 500; ++round) {
+            auto &id = ids[round % ids.size()];
+            while (!ex.destroy(id.load())) {
+                std::this_thread::yield();
+            }
+            id.store(ex.spawn<idle>(session(&c)));
+            ++spawned;
+        }
+        running.store(false);
+        for (auto &t : posters) {
+            t.join();
+        }
+    }
+
+    assert(c.ticks.load() == accepted.load());
+    assert(c.ended.load() == spawned);
+    assert(reported.load() == thrown.load());
+    printf("executor_stress: %ld machines, %ld events, %ld thrown\n", spawned, c.ticks.load(), thrown.load());
+    return 0;
+}
@@ -0,0 +1,80 @@
+/*
+ * inbox_machine: posted events run in the order they were posted, a full
+ * inbox refuses more, and an event whose transition throws is popped like
+ * any other instead of running again on the next run_one().
+ */
+#include <cassert>
+#include <cstdio>
+#include <stdexcept>
+
+#include "fsm_inbox.hpp"
+
+struct tick {
+    int n;
+};
+
+struct boom {};
+
+struct counts {
+    int ticks = 0;
+    int booms = 0;
+};
+
+struct counting {
+    counting(counts *c) : m_counts(c) {}
+
+    template <typename Callable>
+    void operator()(Callable &&) {}
+
+    template <typename Callable>
+    void operator()(tick t, Callable &&) {
+        assert(t.n == m_counts->ticks + 1);
+        ++m_counts->ticks;
+    }
+
+    template <typename Callable>
+    void operator()(boom, Callable &&) {
+        ++m_counts->booms;
+        throw std::runtime_error("boom");
+    }
+
+    counts *m_counts;
+};
+
+using table = std::variant<
+    transition<counting, tick, counting>,
+    transition<counting, boom, counting>
+>;
+
+int main() {
+    counts c;
+    inbox_machine<table, counts *> fsm(4, &c);
+    fsm.start<counting>();
+
+    assert(!fsm.run_one());
+    assert(fsm.post(tick{1}));
+    assert(fsm.post(tick{2}));
+    assert(fsm.post(boom{}));
+    assert(fsm.post(tick{3}));
+    assert(!fsm.post(tick{4}));
+    assert(fsm.pending() == 4);
+
+    assert(fsm.run_one());
+    assert(fsm.run_one());
+    assert(c.ticks == 2);
+
+    bool thrown = false;
+    try {
+        fsm.run_one();
+    } catch (const std::runtime_error &) {
+        thrown = true;
+    }
+    assert(thrown && c.booms == 1);
+
+    assert(fsm.drain() == 1);
+    assert(c.ticks == 3 && c.booms == 1);
+    assert(fsm.pending() == 0);
+
+    printf("inbox: ok\n");
+    return 0;
+}
@@ -0,0 +1,86 @@
+/*
+ * inbox_machine under contention, meant for the thread sanitizer (make
+ * tsan): several producers post numbered events while the owning thread
+ * drains. every event arrives exactly once, each producer's in the order
+ * it posted them.
+ */
+#include <atomic>
+#include <cassert>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+#include "fsm_inbox.hpp"
+
+constexpr int producers = 4;
+constexpr int per_producer = 50000;
+
+struct tick {
+    int producer;
+    int seq;
+};
+
+struct counts {
+    int next[producers] = {};
+    long total = 0;
+};
+
+struct idle {
+    idle(counts *) {}
+
+    template <typename Callable>
+    void operator()(Callable &&) {}
+};
+
+struct counting {
+    counting(counts *c) : m_counts(c) {}
+
+    template <typename Callable>
+    void operator()(tick t, Callable &&) {
+        assert(t.seq == m_counts->next[t.producer]);
+        ++m_counts->next[t.producer];
+        ++m_counts->total;
+    }
+
+    counts *m_counts;
+};
+
+using table = std::variant<
+    transition<idle, tick, counting>,
+    transition<counting, tick, counting>
+>;
+
+int main() {
+    counts c;
+    inbox_machine<table, counts *> fsm(256, &c);
+    fsm.start<idle>();
+
+    std::atomic<int> refused{0};
+    std::vector<std::thread> threads;
+    for (int p = 0; p < producers; ++p) {
+        threads.emplace_back([&fsm, &refused, p] {
+            for (int i = 0; i < per_producer; ++i) {
+                while (!fsm.post(tick{p, i})) {
+                    refused.fetch_add(1, std::memory_order_relaxed);
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+
+    while (c.total < long(producers) * per_producer) {
+        if (fsm.drain() == 0) {
+            std::this_thread::yield();
+        }
+    }
+    for (auto &t : threads) {
+        t.join();
+    }
+
+    assert(fsm.drain() == 0);
+    for (int p = 0; p < producers; ++p) {
+        assert(c.next[p] == per_producer);
+    }
+    printf("inbox_stress: %ld events, %d posts refused while full\n", c.total, refused.load());
+    return 0;
+}
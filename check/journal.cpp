@@ -0,0 +1,188 @@
+/*
+ * journal round trip: a journaled machine's external events are read back
+ * with read_journal() and replayed into a fresh machine, which ends in the
+ * same state and, journaled itself, takes the same transitions, guards
+ * included. each transition names the row taken, also among guarded rows
+ * to the same state. an event without its bytes in the journal is skipped.
+ */
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "fsm_journal.hpp"
+
+struct login {
+    int user;
+};
+
+struct data {
+    int bytes;
+};
+
+struct logout {};
+
+// not trivially copyable: journaled without its bytes
+struct note {
+    std::string text;
+};
+
+struct ledger {
+    int bytes = 0;
+};
+
+struct idle {
+    idle(ledger *) {}
+
+    template <typename Callable>
+    void operator()(Callable &&) {}
+
+    template <typename Event, typename Callable>
+    void operator()(Event &&, Callable &&) {}
+};
+
+struct authed {
+    authed(ledger *) {}
+
+    template <typename Event, typename Callable>
+    void operator()(Event &&, Callable &&) {}
+};
+
+struct busy {
+    busy(ledger *l) : m_ledger(l) {}
+
+    template <typename Callable>
+    void operator()(data d, Callable &&) {
+        m_ledger->bytes += d.bytes;
+    }
+
+    ledger *m_ledger;
+};
+
+struct known_user {
+    bool operator()(const idle &, const login &l) const { return l.user > 0; }
+};
+
+struct tiny {
+    bool operator()(const authed &, const data &d) const { return d.bytes < 16; }
+};
+
+struct small {
+    bool operator()(const busy &, const data &d) const { return d.bytes < 100; }
+};
+
+using table = std::variant<
+    transition<idle, login, authed, known_user>,
+    transition<idle, login, idle>,
+    transition<authed, data, busy, tiny>,
+    transition<authed, data, busy>,
+    transition<authed, note, authed>,
+    transition<busy, data, busy, small>,
+    transition<busy, data, authed>,
+    transition<authed, logout, idle>,
+    transition<busy, logout, idle>
+>;
+
+struct journaled : default_policy {
+    using trace = journal_trace<table>;
+};
+
+class machine : public state_machine<table, ledger *, journaled> {
+public:
+    using state_machine::state_machine;
+    using state_machine::push;
+};
+
+// the transitions machine id took, in order, leaving out those on note
+std::vector<journal_record> transitions_of(const std::vector<journal_entry> &entries, std::uint32_t id) {
+    std::vector<journal_record> out;
+    for (const journal_entry &e : entries) {
+        if (e.record.machine == id && e.record.kind == journal_record::transition &&
+            e.record.event != index_of_v<note, machine::events>) {
+            out.push_back(e.record);
+        }
+    }
+    return out;
+}
+
+std::size_t state_of(const machine &m) {
+    unsigned char record[machine::snapshot_size];
+    const std::size_t n = m.snapshot(record, sizeof(record));
+    assert(n >= sizeof(snapshot_header));
+    snapshot_header header;
+    std::memcpy(&header, record, sizeof(header));
+    return header.state;
+}
+
+std::vector<journal_entry> read_back(std::FILE *f) {
+    std::vector<journal_entry> entries;
+    std::rewind(f);
+    const bool complete = read_journal(f, entries);
+    assert(complete);
+    return entries;
+}
+
+int main() {
+    journal_options opts;
+    opts.wait_when_full = true;
+
+    std::FILE *first = std::tmpfile();
+    assert(first);
+    journal::open(first, opts);
+    ledger original_ledger;
+    machine original(&original_ledger);
+    original.start<idle>();
+    original.push(login{0});        // refused by the guard, stays idle
+    original.push(login{7});
+    original.push(data{10});
+    original.push(data{20});
+    original.push(data{500});       // too big, back to authed
+    original.push(note{"checkpoint"});
+    original.push(data{30});
+    journal::close();
+    assert(journal::dropped() == 0);
+
+    const std::vector<journal_entry> entries = read_back(first);
+    assert(!entries.empty());
+
+    std::FILE *second = std::tmpfile();
+    assert(second);
+    journal::open(second, opts);
+    ledger replayed_ledger;
+    machine replayed(&replayed_ledger);
+    replayed.start<idle>();
+    const replay_result r = replay<machine>(entries, original.trace().id(), [&](auto && evt) {
+        replayed.push(evt);
+    });
+    journal::close();
+
+    assert(r.replayed == 6 && r.skipped == 1);
+    assert(state_of(replayed) == state_of(original));
+    assert(state_of(original) == (index_of_v<busy, machine::states>));
+    assert(replayed_ledger.bytes == original_ledger.bytes && original_ledger.bytes == 60);
+
+    const std::vector<journal_record> before = transitions_of(entries, original.trace().id());
+    const std::vector<journal_record> after = transitions_of(read_back(second), replayed.trace().id());
+    assert(before.size() == 6 && after.size() == before.size());
+    const std::uint16_t rows[] = {1, 0, 2, 5, 6, 3};
+    for (std::size_t i = 0; i < before.size(); ++i) {
+        assert(before[i].state == after[i].state && before[i].event == after[i].event &&
+               before[i].next == after[i].next && before[i].row == after[i].row);
+        assert(before[i].row == rows[i]);
+    }
+
+    // not a journal
+    std::FILE *garbage = std::tmpfile();
+    assert(garbage);
+    std::fputs("not a journal", garbage);
+    std::rewind(garbage);
+    std::vector<journal_entry> none;
+    assert(!read_journal(garbage, none) && none.empty());
+
+    std::fclose(first);
+    std::fclose(second);
+    std::fclose(garbage);
+    printf("journal: ok\n");
+    return 0;
+}
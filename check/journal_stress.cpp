@@ -0,0 +1,80 @@
+/*
+ * journal::append() racing open() and close(), meant for the thread
+ * sanitizer (make tsan). every session's file must hold whole records, and
+ * no record may turn up in a later session than one holding a record its
+ * thread appended after it: an append close() did not wait for would be
+ * flushed into the next file.
+ */
+#include <atomic>
+#include <cassert>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+#include "fsm_journal.hpp"
+
+constexpr int recorders = 3;
+constexpr int sessions = 200;
+
+int main() {
+    journal_options opts;
+    opts.ring_capacity = 1 << 12;
+    opts.interval = std::chrono::microseconds(20);
+
+    std::atomic<bool> running{true};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < recorders; ++t) {
+        threads.emplace_back([&running, t] {
+            journal_record r{};
+            r.kind = journal_record::external;
+            r.machine = std::uint32_t(t);
+            while (running.load(std::memory_order_relaxed)) {
+                journal::append(r);
+                ++r.reserved;
+            }
+        });
+    }
+
+    // per recorder, the highest sequence number in the sessions so far
+    std::int64_t last[recorders];
+    for (auto &l : last) {
+        l = -1;
+    }
+    std::size_t records = 0;
+    for (int s = 0; s < sessions; ++s) {
+        std::FILE *f = std::tmpfile();
+        assert(f);
+        journal::open(f, opts);
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+        journal::close();
+
+        std::rewind(f);
+        std::vector<journal_entry> entries;
+        const bool complete = read_journal(f, entries);
+        assert(complete);
+        std::fclose(f);
+
+        std::int64_t seen[recorders];
+        for (int t = 0; t < recorders; ++t) {
+            seen[t] = last[t];
+        }
+        for (const journal_entry &e : entries) {
+            assert(e.record.kind == journal_record::external && e.record.machine < recorders);
+            const std::int64_t seq = e.record.reserved;
+            assert(seq > seen[e.record.machine]);
+            seen[e.record.machine] = seq;
+        }
+        for (int t = 0; t < recorders; ++t) {
+            last[t] = seen[t];
+        }
+        records += entries.size();
+    }
+    running.store(false);
+    for (auto &t : threads) {
+        t.join();
+    }
+
+    printf("journal_stress: %d sessions, %zu records, %llu dropped\n", sessions, records,
+           static_cast<unsigned long long>(journal::dropped()));
+    return 0;
+}
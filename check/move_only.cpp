@@ -0,0 +1,91 @@
+/*
+ * move-only events: a state hands a std::unique_ptr member of its own on
+ * with cb(std::move(m_frame)), and the next state receives it intact even
+ * though the sender is destroyed in between. for the machine and the pool,
+ * recursive and run-to-completion.
+ */
+#include <cassert>
+#include <cstdio>
+#include <memory>
+
+#include "fsm.hpp"
+#include "fsm_pool.hpp"
+
+struct frame {
+    int seq;
+};
+
+using frame_ptr = std::unique_ptr<frame>;
+
+struct go {};
+
+struct wire {
+    int received = 0;
+};
+
+struct receiving {
+    receiving(wire *) {}
+
+    template <typename Callable>
+    void operator()(Callable &&) {}
+
+    template <typename Callable>
+    void operator()(go, Callable && cb) {
+        m_frame = std::make_unique<frame>(frame{7});
+        cb(std::move(m_frame));
+    }
+
+    frame_ptr m_frame;
+};
+
+struct sending {
+    sending(wire *w) : m_wire(w) {}
+
+    template <typename Callable>
+    void operator()(frame_ptr f, Callable &&) {
+        assert(f && f->seq == 7);
+        m_wire->received = f->seq;
+    }
+
+    wire *m_wire;
+};
+
+using table = std::variant<
+    transition<receiving, go, receiving>,
+    transition<receiving, frame_ptr, sending>
+>;
+
+struct rtc_policy : default_policy {
+    static constexpr std::size_t queue_capacity = 2;
+};
+
+template <typename Policy>
+class machine : public state_machine<table, wire *, Policy> {
+    using base = state_machine<table, wire *, Policy>;
+public:
+    using base::base;
+    using base::push;
+};
+
+template <typename Policy>
+void check() {
+    wire w;
+    machine<Policy> fsm(&w);
+    fsm.template start<receiving>();
+    fsm.push(go{});
+    assert(w.received == 7);
+
+    wire pw;
+    machine_pool<table, wire *, Policy> pool(2, &pw);
+    const auto id = pool.template start<receiving>();
+    pool.push(id, go{});
+    assert(pool.template is<sending>(id));
+    assert(pw.received == 7);
+}
+
+int main() {
+    check<default_policy>();
+    check<rtc_policy>();
+    printf("move_only: ok\n");
+    return 0;
+}
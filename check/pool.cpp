@@ -0,0 +1,198 @@
+/*
+ * machine_pool with a state's accept() hook and a trace's on_external():
+ * the hook consumes events pushed to one machine and broadcast to all, and
+ * the trace hears about every event from outside, once per machine it
+ * reaches, but not about those states emit. a slot is freed once, by
+ * release() or by a state constructor that throws, and events queued for
+ * it are dropped with the throw.
+ */
+#include <cassert>
+#include <cstdio>
+#include <stdexcept>
+
+#include "fsm_pool.hpp"
+
+struct credit {
+    int amount;
+};
+
+struct spend {};
+struct refill {};
+
+struct account {
+    int spent = 0;
+    int credits = 0;
+};
+
+// takes credits without leaving, spends while there are any
+struct open_account {
+    open_account(account *a) : m_account(a) {}
+
+    template <typename Callable>
+    void operator()(Callable &&) {}
+
+    template <typename Event, typename Callable>
+    void operator()(Event &&, Callable &&) {}
+
+    template <typename Callable>
+    bool accept(credit &c, Callable &&) {
+        m_balance += c.amount;
+        ++m_account->credits;
+        c.amount = 0;
+        return true;
+    }
+
+    template <typename Callable>
+    bool accept(spend &, Callable &&) {
+        if (m_balance == 0) {
+            return false;
+        }
+        --m_balance;
+        ++m_account->spent;
+        return true;
+    }
+
+    account *m_account;
+    int m_balance = 0;
+};
+
+// a refill emitted on entry takes it straight back to open
+struct drained {
+    drained(account *) {}
+
+    template <typename Callable>
+    void operator()(spend, Callable && cb) {
+        cb(refill{});
+    }
+};
+
+using table = std::variant<
+    transition<open_account, spend, drained>,
+    transition<drained, refill, open_account>
+>;
+
+struct counting_trace {
+    template <typename State, typename Event, typename Next>
+    void on_transition(const Event &) { ++transitions; }
+
+    template <typename State, typename Event>
+    void on_unmatched(const Event &) {}
+
+    template <typename Event>
+    void on_external(const Event &) { ++external; }
+
+    int transitions = 0;
+    int external = 0;
+};
+
+template <std::size_t QueueCapacity>
+struct pool_policy : default_policy {
+    using trace = counting_trace;
+    static constexpr std::size_t queue_capacity = QueueCapacity;
+};
+
+struct kick {};
+struct go_bad {};
+
+// a kick leads on to a state that never gets built, then kicks again
+struct stable {
+    stable(account *a) : m_account(a) {}
+
+    template <typename Callable>
+    void operator()(Callable &&) {}
+
+    template <typename Callable>
+    void operator()(kick, Callable && cb) {
+        ++m_account->spent;
+        cb(go_bad{});
+        cb(kick{});
+    }
+
+    account *m_account;
+};
+
+struct broken {
+    broken(account *) { throw std::runtime_error("broken"); }
+
+    template <typename Event, typename Callable>
+    void operator()(Event &&, Callable &&) {}
+};
+
+using fragile_table = std::variant<
+    transition<stable, kick, stable>,
+    transition<stable, go_bad, broken>,
+    transition<broken, kick, stable>
+>;
+
+template <std::size_t QueueCapacity>
+void check_slots() {
+    account a;
+    using pool_type = machine_pool<fragile_table, account *, pool_policy<QueueCapacity>>;
+    pool_type pool(2, &a);
+    const auto first = pool.template start<stable>();
+    const auto second = pool.template start<stable>();
+
+    assert(pool.release(first));
+    assert(!pool.release(first));
+    assert(pool.size() == 1);
+    assert(pool.template start<stable>() == first);
+    bool full = false;
+    try {
+        pool.template start<stable>();
+    } catch (const std::length_error &) {
+        full = true;
+    }
+    assert(full);
+
+    // the go_bad takes first to broken, the kick after it goes nowhere
+    bool thrown = false;
+    try {
+        pool.push(first, kick{});
+    } catch (const std::runtime_error &) {
+        thrown = true;
+    }
+    assert(thrown && a.spent == 1);
+    assert(pool.size() == 1 && pool.state_index(first) == pool_type::no_state);
+    assert(!pool.release(first));
+    assert(pool.template start<stable>() == first);
+    pool.push(second, spend{});
+    assert(a.spent == 1 && pool.template is<stable>(first));
+}
+
+template <std::size_t QueueCapacity>
+void check() {
+    account a;
+    machine_pool<table, account *, pool_policy<QueueCapacity>> pool(3, &a);
+    const auto first = pool.template start<open_account>();
+    const auto second = pool.template start<open_account>();
+    assert(pool.trace().external == 0);
+
+    pool.push(first, credit{2});
+    assert(a.credits == 1 && pool.trace().transitions == 0);
+
+    // two spends on credit, the third goes through drained and back
+    for (int i = 0; i < 3; ++i) {
+        pool.push(first, spend{});
+    }
+    assert(a.spent == 2 && pool.template is<open_account>(first));
+    assert(pool.trace().transitions == 2 && pool.trace().external == 4);
+
+    // every machine gets its own copy to change
+    const credit c{1};
+    pool.broadcast(c);
+    assert(a.credits == 3 && c.amount == 1 && pool.trace().external == 6);
+
+    const decltype(first) ids[] = {first, second, first};
+    pool.push(ids, 3, spend{});
+    assert(a.spent == 4 && pool.trace().transitions == 4 && pool.trace().external == 9);
+    assert(pool.template is<open_account>(first) && pool.template is<open_account>(second));
+}
+
+int main() {
+    check<0>();
+    check<4>();
+    check_slots<0>();
+    check_slots<4>();
+    printf("pool: ok\n");
+    return 0;
+}
@@ -0,0 +1,196 @@
+/*
+ * push_batch() against pushing the same events one by one: for random
+ * bursts over a table with guards, an accept() hook, unmatched events and
+ * events emitted on entry, both end in the same state with the same
+ * context, trace and callbacks, for every dispatch backend and queue mode.
+ */
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "fsm.hpp"
+
+struct byte_in {
+    int value;
+};
+
+struct flush {};
+struct reset {};
+struct echo {};
+
+struct tally {
+    int sum = 0;
+    int resets = 0;
+};
+
+struct collecting {
+    collecting(tally *t) : m_tally(t) {}
+
+    template <typename Callable>
+    void operator()(Callable &&) {}
+
+    template <typename Callable>
+    void operator()(byte_in b, Callable &&) {
+        m_tally->sum += b.value;
+    }
+
+    template <typename Callable>
+    void operator()(echo, Callable &&) {
+        m_tally->sum = 0;
+    }
+
+    template <typename Callable>
+    void operator()(reset, Callable &&) {
+        m_tally->sum = 0;
+    }
+
+    // a reset while collecting stays here
+    template <typename Callable>
+    bool accept(reset &, Callable &&) {
+        ++m_tally->resets;
+        m_tally->sum = 0;
+        return true;
+    }
+
+    tally *m_tally;
+};
+
+struct full {
+    full(tally *) {}
+
+    template <typename Event, typename Callable>
+    void operator()(Event &&, Callable &&) {}
+};
+
+// emits an echo on entry, which takes it straight back
+struct drained {
+    drained(tally *) {}
+
+    template <typename Callable>
+    void operator()(Callable &&) {}
+
+    template <typename Callable>
+    void operator()(flush, Callable && cb) {
+        cb(echo{});
+    }
+};
+
+struct fits {
+    bool operator()(const collecting &s, const byte_in &b) const { return s.m_tally->sum + b.value <= 10; }
+};
+
+using table = std::variant<
+    transition<collecting, byte_in, collecting, fits>,
+    transition<collecting, byte_in, full>,
+    transition<collecting, flush, drained>,
+    transition<drained, echo, collecting>,
+    transition<full, reset, collecting>,
+    transition<full, flush, full>
+>;
+
+struct recording_trace {
+    template <typename State, typename Event, typename Next>
+    void on_transition(const Event &) {
+        log.push_back(std::string(type_name<State>()) + " + " + std::string(type_name<Event>()) + " > " + std::string(type_name<Next>()));
+    }
+
+    template <typename State, typename Event>
+    void on_unmatched(const Event &) {
+        log.push_back(std::string(type_name<State>()) + " + " + std::string(type_name<Event>()) + " unmatched");
+    }
+
+    template <typename Event>
+    void on_external(const Event &) {
+        log.push_back("external " + std::string(type_name<Event>()));
+    }
+
+    std::vector<std::string> log;
+};
+
+template <typename Dispatch, std::size_t QueueCapacity>
+struct batch_policy : default_policy {
+    using trace = recording_trace;
+    using dispatch = Dispatch;
+    static constexpr std::size_t queue_capacity = QueueCapacity;
+};
+
+template <typename Policy>
+class machine : public state_machine<table, tally *, Policy> {
+    using base = state_machine<table, tally *, Policy>;
+public:
+    using base::base;
+    using base::push;
+    using base::push_batch;
+
+    std::size_t state_index() const {
+        unsigned char record[base::snapshot_size];
+        snapshot_header header;
+        const std::size_t n = this->snapshot(record, sizeof(record));
+        assert(n >= sizeof(header));
+        std::memcpy(&header, record, sizeof(header));
+        return header.state;
+    }
+};
+
+// small deterministic generator, the same bursts on every run
+struct lcg {
+    unsigned next() {
+        m_state = m_state * 1103515245u + 12345u;
+        return (m_state >> 16) & 0x7fff;
+    }
+
+    unsigned m_state = 42;
+};
+
+template <typename Policy>
+void check(const char *name) {
+    using events = typename machine<Policy>::events;
+    lcg rng;
+    for (int round = 0; round < 500; ++round) {
+        std::vector<events> burst;
+        const unsigned length = rng.next() % 65;
+        for (unsigned i = 0; i < length; ++i) {
+            switch (rng.next() % 4) {
+            case 0:
+            case 1: burst.emplace_back(byte_in{int(rng.next() % 5)}); break;
+            case 2: burst.emplace_back(flush{}); break;
+            default: burst.emplace_back(reset{}); break;
+            }
+        }
+        std::vector<events> copy = burst;
+
+        tally one_tally, batch_tally;
+        int one_unmatched = 0, batch_unmatched = 0;
+        machine<Policy> one(&one_tally), batched(&batch_tally);
+        one.set_callback([&one_unmatched](const std::error_code &) { ++one_unmatched; });
+        batched.set_callback([&batch_unmatched](const std::error_code &) { ++batch_unmatched; });
+        one.template start<collecting>();
+        batched.template start<collecting>();
+
+        for (auto &evt : burst) {
+            std::visit([&](auto & e) {
+                one.push(std::move(e));
+            }, evt);
+        }
+        batched.push_batch(copy.data(), copy.size());
+
+        assert(one.state_index() == batched.state_index());
+        assert(one_tally.sum == batch_tally.sum && one_tally.resets == batch_tally.resets);
+        assert(one_unmatched == batch_unmatched);
+        assert(one.trace().log == batched.trace().log);
+    }
+    printf("push_batch: %s ok\n", name);
+}
+
+int main() {
+    check<batch_policy<visit_dispatch, 0>>("visit, recursive");
+    check<batch_policy<visit_dispatch, 4>>("visit, run to completion");
+    check<batch_policy<switch_dispatch, 0>>("switch, recursive");
+    check<batch_policy<switch_dispatch, 4>>("switch, run to completion");
+    check<batch_policy<table_dispatch, 0>>("table, recursive");
+    check<batch_policy<table_dispatch, 4>>("table, run to completion");
+    return 0;
+}
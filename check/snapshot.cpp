@@ -0,0 +1,178 @@
+/*
+ * snapshot() and restore(): a record brings a state and its snapshot_type
+ * back in another machine, byte for byte; records that are truncated, from
+ * another version, or for another set of states are refused and leave the
+ * machine as it was.
+ */
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+
+#include "fsm.hpp"
+
+struct open_link {
+    int fd;
+};
+
+struct packet {};
+struct close_link {};
+
+struct link_stats {
+    int fd_seen = -1;
+    int packets = 0;
+};
+
+struct idle {
+    idle(link_stats *) {}
+
+    template <typename Callable>
+    void operator()(Callable &&) {}
+};
+
+struct connected {
+    struct snapshot_type {
+        int fd;
+        int packets;
+    };
+
+    connected(link_stats *stats) : m_stats(stats) {}
+    connected(link_stats *stats, const snapshot_type &s) : m_stats(stats), m_fd(s.fd), m_packets(s.packets) {}
+
+    snapshot_type snapshot() const { return {m_fd, m_packets}; }
+
+    template <typename Callable>
+    void operator()(open_link o, Callable &&) {
+        m_fd = o.fd;
+    }
+
+    // packets stay in the state
+    template <typename Callable>
+    bool accept(packet &, Callable &&) {
+        m_stats->fd_seen = m_fd;
+        m_stats->packets = ++m_packets;
+        return true;
+    }
+
+    link_stats *m_stats;
+    int m_fd = -1;
+    int m_packets = 0;
+};
+
+struct closed {
+    closed(link_stats *) {}
+
+    template <typename Callable>
+    void operator()(close_link, Callable &&) {}
+};
+
+struct draining {
+    draining(link_stats *) {}
+
+    template <typename Callable>
+    void operator()(close_link, Callable &&) {}
+};
+
+using table = std::variant<
+    transition<idle, open_link, connected>,
+    transition<connected, close_link, closed>
+>;
+
+// the same events, one more state
+using other_table = std::variant<
+    transition<idle, open_link, connected>,
+    transition<connected, close_link, draining>,
+    transition<draining, close_link, closed>
+>;
+
+template <typename Table>
+class machine : public state_machine<Table, link_stats *> {
+    using base = state_machine<Table, link_stats *>;
+public:
+    using base::base;
+    using base::push;
+};
+
+int main() {
+    using link = machine<table>;
+    unsigned char record[link::snapshot_size];
+    unsigned char again[link::snapshot_size];
+
+    link_stats a_stats;
+    link a(&a_stats);
+    assert(a.snapshot(record, sizeof(record)) == 0);     // not started
+    a.start<idle>();
+    a.push(open_link{5});
+    a.push(packet{});
+    a.push(packet{});
+    assert(a.snapshot(record, sizeof(record) - 1) == 0);
+    const std::size_t size = a.snapshot(record, sizeof(record));
+    assert(size == link::snapshot_size);
+
+    // restored: fd and packet count are back, and it snapshots the same
+    link_stats b_stats;
+    link b(&b_stats);
+    b.start<idle>();
+    assert(b.restore(record, size));
+    assert(b.snapshot(again, sizeof(again)) == size);
+    assert(std::memcmp(record, again, size) == 0);
+    b.push(packet{});
+    assert(b_stats.fd_seen == 5 && b_stats.packets == 3);
+
+    // a state without snapshot_type comes back by index
+    link_stats c_stats;
+    link c(&c_stats);
+    c.start<idle>();
+    c.push(open_link{6});
+    c.push(close_link{});
+    const std::size_t closed_size = c.snapshot(record, sizeof(record));
+    assert(closed_size == sizeof(snapshot_header));
+    assert(b.restore(record, closed_size));
+    b.push(packet{});
+    assert(b_stats.packets == 3);
+
+    // bad records, each must leave d in idle
+    link_stats d_stats;
+    link d(&d_stats);
+    d.start<idle>();
+    a.snapshot(record, sizeof(record));
+    snapshot_header header;
+    std::memcpy(&header, record, sizeof(header));
+
+    auto refused = [&](snapshot_header h, std::size_t n) {
+        unsigned char bad[link::snapshot_size];
+        std::memcpy(bad, record, sizeof(bad));
+        std::memcpy(bad, &h, sizeof(h));
+        return !d.restore(bad, n);
+    };
+    snapshot_header h = header;
+    h.magic ^= 1;
+    assert(refused(h, size));
+    h = header;
+    h.version += 1;
+    assert(refused(h, size));
+    h = header;
+    h.state = std::variant_size_v<link::states>;
+    assert(refused(h, size));
+    h = header;
+    h.size += 1;
+    assert(refused(h, size));
+    assert(refused(header, size - 1));
+    assert(refused(header, sizeof(header) - 1));
+
+    // a record of another table with the same state at the same index
+    link_stats e_stats;
+    machine<other_table> e(&e_stats);
+    e.start<idle>();
+    e.push(open_link{7});
+    unsigned char foreign[machine<other_table>::snapshot_size];
+    const std::size_t foreign_size = e.snapshot(foreign, sizeof(foreign));
+    assert(foreign_size > 0);
+    assert(!d.restore(foreign, foreign_size));
+
+    d.push(open_link{8});
+    d.push(packet{});
+    assert(d_stats.fd_seen == 8 && d_stats.packets == 1);
+
+    printf("snapshot: ok\n");
+    return 0;
+}
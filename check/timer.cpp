@@ -0,0 +1,243 @@
+/*
+ * timer_wheel on a clock it is handed, so every tick is exact: entries on
+ * each level and past the horizon fire at their tick and not before, after
+ * cascading down; a callback may cancel entries due with it or later and
+ * re-arm itself. fsm_timer: a state's timeout reaches the machine as an
+ * external event, a state that is left cancels it, and arming again
+ * replaces the pending one.
+ */
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+#include "fsm_timer.hpp"
+
+using std::chrono::milliseconds;
+
+struct probe : wheel_entry {
+    probe() { on_expiry = &probe::fired; }
+
+    static void fired(wheel_entry &e) {
+        probe &p = static_cast<probe &>(e);
+        p.at.push_back(p.wheel->now());
+        if (p.then) {
+            p.then(p);
+        }
+    }
+
+    timer_wheel *wheel = nullptr;
+    std::vector<std::uint64_t> at;
+    void (*then)(probe &) = nullptr;
+};
+
+void check_levels() {
+    const auto t0 = timer_wheel::clock::now();
+    timer_wheel wheel(milliseconds(1), t0);
+    auto at = [t0](std::uint64_t tick) { return t0 + milliseconds(tick); };
+
+    // both sides of every level boundary, and two past the horizon
+    const std::uint64_t horizon = std::uint64_t(1) << 32;
+    const std::uint64_t due[] = {
+        1, 255, 256, 257, 65535, 65536, 65537, 70000,
+        (1u << 24) - 1, 1u << 24, (1u << 24) + 5, horizon - 1, horizon + 1000, 3 * horizon + 7,
+    };
+    constexpr std::size_t count = sizeof(due) / sizeof(due[0]);
+    probe probes[count];
+    for (std::size_t i = 0; i < count; ++i) {
+        probes[i].wheel = &wheel;
+        wheel.schedule(probes[i], milliseconds(due[i]));
+    }
+    assert(wheel.pending() == count);
+
+    for (std::size_t i = 0; i < count; ++i) {
+        assert(wheel.advance(at(due[i] - 1)) == 0);
+        assert(probes[i].at.empty());
+        assert(wheel.advance(at(due[i])) == 1);
+        assert(probes[i].at.size() == 1 && probes[i].at[0] == due[i]);
+        assert(wheel.pending() == count - i - 1);
+    }
+    assert(wheel.advance(at(4 * horizon)) == 0);
+}
+
+void check_callbacks() {
+    const auto t0 = timer_wheel::clock::now();
+    timer_wheel wheel(milliseconds(1), t0);
+    auto at = [t0](std::uint64_t tick) { return t0 + milliseconds(tick); };
+
+    // first cancels the entry due with it and one due later, then comes
+    // back every 10 ticks
+    static probe *same_tick, *later;
+    probe first, second, third, untouched;
+    for (probe *p : {&first, &second, &third, &untouched}) {
+        p->wheel = &wheel;
+    }
+    same_tick = &second;
+    later = &third;
+    first.then = [](probe &p) {
+        p.wheel->cancel(*same_tick);
+        p.wheel->cancel(*later);
+        p.wheel->schedule(p, milliseconds(10));
+    };
+    wheel.schedule(first, milliseconds(300));
+    wheel.schedule(second, milliseconds(300));
+    wheel.schedule(third, milliseconds(305));
+    wheel.schedule(untouched, milliseconds(307));
+
+    assert(wheel.advance(at(300)) == 1);
+    assert(second.at.empty() && !second.linked() && !third.linked());
+    assert(wheel.pending() == 2);
+    assert(wheel.advance(at(330)) == 4);
+    assert(third.at.empty() && untouched.at.size() == 1 && untouched.at[0] == 307);
+    assert((first.at == std::vector<std::uint64_t>{300, 310, 320, 330}));
+
+    // a cancelled entry can be scheduled again, moving it replaces the deadline
+    first.then = nullptr;
+    wheel.cancel(first);
+    wheel.schedule(second, milliseconds(5));
+    wheel.schedule(second, milliseconds(50));
+    assert(wheel.pending() == 1);
+    assert(wheel.advance(at(379)) == 0);
+    assert(wheel.advance(at(380)) == 1 && second.at.size() == 1 && second.at[0] == 380);
+}
+
+struct request {};
+struct reply {};
+struct timeout {};
+struct retry {};
+
+struct outcome {
+    int replies = 0;
+    int timeouts = 0;
+};
+
+using context = timer_context<outcome>;
+
+struct idle {
+    idle(context &) {}
+
+    template <typename Callable>
+    void operator()(Callable &&) {}
+};
+
+// waits 10 ticks for a reply, a retry starts the wait over
+struct waiting {
+    waiting(context &ctx) : m_timeout(ctx.timers()) {}
+
+    // the second arm() replaces the first
+    template <typename Callable>
+    void operator()(request, Callable && cb) {
+        m_timeout.arm(milliseconds(5), cb, timeout{});
+        m_timeout.arm(milliseconds(10), cb, timeout{});
+    }
+
+    template <typename Callable>
+    void operator()(retry, Callable && cb) {
+        m_timeout.arm(milliseconds(10), cb, timeout{});
+    }
+
+    fsm_timer<> m_timeout;
+};
+
+struct answered {
+    answered(context &ctx) : m_ctx(&ctx) {}
+
+    template <typename Callable>
+    void operator()(reply, Callable &&) {
+        ++m_ctx->replies;
+    }
+
+    context *m_ctx;
+};
+
+struct timed_out {
+    timed_out(context &ctx) : m_ctx(&ctx) {}
+
+    template <typename Callable>
+    void operator()(timeout, Callable &&) {
+        ++m_ctx->timeouts;
+    }
+
+    context *m_ctx;
+};
+
+using table = std::variant<
+    transition<idle, request, waiting>,
+    transition<waiting, reply, answered>,
+    transition<waiting, timeout, timed_out>,
+    transition<waiting, retry, waiting>
+>;
+
+struct external_trace : no_trace {
+    template <typename Event>
+    void on_external(const Event &) {
+        if constexpr (std::is_same_v<Event, timeout>) {
+            ++timeouts;
+        }
+    }
+
+    int timeouts = 0;
+};
+
+template <std::size_t QueueCapacity>
+struct timer_policy : default_policy {
+    using trace = external_trace;
+    static constexpr std::size_t queue_capacity = QueueCapacity;
+};
+
+template <typename Policy>
+class machine : public state_machine<table, context, Policy> {
+    using base = state_machine<table, context, Policy>;
+public:
+    using base::base;
+    using base::push;
+};
+
+template <typename Policy>
+void check_states() {
+    const auto t0 = timer_wheel::clock::now();
+    timer_wheel wheel(milliseconds(1), t0);
+    auto at = [t0](std::uint64_t tick) { return t0 + milliseconds(tick); };
+
+    // answered in time: leaving waiting cancels its timeout
+    machine<Policy> quick(context{wheel});
+    quick.template start<idle>();
+    quick.push(request{});
+    assert(wheel.pending() == 1);
+    quick.push(reply{});
+    assert(wheel.pending() == 0);
+    assert(wheel.advance(at(20)) == 0);
+    assert(quick.context().replies == 1 && quick.context().timeouts == 0);
+    assert(quick.trace().timeouts == 0);
+
+    // never answered: the timeout comes in from outside at tick 30
+    machine<Policy> slow(context{wheel});
+    slow.template start<idle>();
+    slow.push(request{});
+    assert(wheel.advance(at(29)) == 0);
+    assert(wheel.advance(at(30)) == 1);
+    assert(slow.context().timeouts == 1 && slow.trace().timeouts == 1);
+    assert(wheel.pending() == 0);
+
+    // the retry leaves waiting and enters it again: the first timeout is
+    // cancelled with the state, only the new one fires
+    machine<Policy> retried(context{wheel});
+    retried.template start<idle>();
+    retried.push(request{});
+    assert(wheel.advance(at(35)) == 0);
+    retried.push(retry{});
+    assert(wheel.pending() == 1);
+    assert(wheel.advance(at(44)) == 0);
+    assert(wheel.advance(at(45)) == 1);
+    assert(retried.context().timeouts == 1 && retried.trace().timeouts == 1);
+}
+
+int main() {
+    check_levels();
+    check_callbacks();
+    check_states<timer_policy<0>>();
+    check_states<timer_policy<4>>();
+    printf("timer: ok\n");
+    return 0;
+}
@@ -7,8 +7,10 @@
 #include <any>
 #include <functional>
 #include <type_traits>
+#include <string>
 
 #include "fsm.hpp"
+#include "fsm_analysis.hpp"
 
 template <typename result>
 struct state {};
@@ -29,7 +31,7 @@ struct success {
     T value;
 };
 
-using exception = std::runtime_error;
+// failures travel as error_event (fsm.hpp): an error_code plus a static context string
 
 
 // context for states, wrapping up common stuff shared across all states, if really needed
@@ -44,12 +46,13 @@ struct context {
  * state definitions
  */
 
-using SharedContext = std::shared_ptr<context>;
+// the machine owns the context, states share it through a non-owning handle
+using ContextRef = context_ref<context>;
 //
 // start state, does nothing
 //
 struct start {
-    start(SharedContext ctx, std::string ip, std::string user, std::string pass) :
+    start(ContextRef ctx, std::string ip, std::string user, std::string pass) :
         m_ctx(ctx)
     {}
 
@@ -59,7 +62,7 @@ struct start {
         cb(e);
     }
 
-    SharedContext m_ctx;
+    ContextRef m_ctx;
 };
 
 
@@ -67,7 +70,7 @@ struct start {
 // connecting state: connects a socket to a given host
 //
 struct connecting {
-    connecting(std::shared_ptr<context> ctx) :
+    connecting(ContextRef ctx) :
         m_ctx(ctx)
     {}
 
@@ -79,65 +82,78 @@ struct connecting {
     }
 
 protected:
-    std::shared_ptr<context> m_ctx;
+    ContextRef m_ctx;
 };
 
 // connected state: sends some initial data over the socket
 struct connected {
-    connected(std::shared_ptr<context> ctx) : m_ctx(ctx) {}
+    connected(ContextRef ctx) : m_ctx(ctx) {}
 
     template <typename Callable>
     void operator()(success<sock>, Callable && cb) {
-        cb(std::runtime_error("remote disconnect"));
+        cb(error_event(std::errc::connection_reset, "remote disconnect"));
     }
 
-    std::shared_ptr<context> m_ctx;
+    ContextRef m_ctx;
 };
 
 struct disconnected {};
 
 struct failed {
-    failed(std::shared_ptr<context> ctx) : m_ctx(ctx) {}
+    failed(ContextRef ctx) : m_ctx(ctx) {}
 
     template <typename Callable>
-    void operator()(exception e, Callable && cb) {
-        m_ctx->log(std::string("failed: ") + e.what());
-        cb(e);
+    void operator()(error_event e, Callable &&) {
+        m_ctx->log(std::string("failed: ") + e.context);
+    }
+
+    // entered through the any_event row below for everything else
+    template <typename Event, typename Callable>
+    void operator()(const Event &, Callable &&) {
+        m_ctx->log("failed: ignoring event");
     }
-    SharedContext m_ctx;
+
+    ContextRef m_ctx;
 };
 
 
+// every state on the way up shares the failure row
+struct online : composite<start, connecting, connected> {};
+
 /*
  * obviously, we could introduce other kinds of structs
- * into the transitions, like explicit start/stop states
- * any handle std::any as a wildcard event
+ * into the transitions, like explicit start/stop states.
+ * any_event is the wildcard: its row is taken when no exact one matches
  */
 
 using transitions = std::variant<
 /*  ---------- | state      | event ------------| followup-state -- */
     transition  <start,       success<sock>,      connecting>,
-    transition  <start,       exception,          failed>,
-
     transition  <connecting,  success<sock>,      connected>,
-    transition  <connecting,  exception,          failed>,
 
-    transition  <connected,   exception,          failed>,
-    transition  <failed,      std::any,           failed>
+    transition  <online,      error_event,        failed>,
+    transition  <failed,      any_event,          failed>
 
 >;
 
-//using states = remove_duplicates_t<decltype(extract_states(table))>;
+// every state can be entered from start, none is dead weight in the variant
+static_assert(table_analysis<transitions>::all_reachable<start>, "unreachable states in the table");
+
+// print transitions, handle events emitted by states run-to-completion
+struct traced : default_policy {
+    using trace = printf_trace;
+    static constexpr std::size_t queue_capacity = 4;
+    static constexpr bool context_by_reference = true;
+};
 
 
 int main(int, char **) {
-    SharedContext ctx = std::make_shared<context>();
-    state_machine<transitions, SharedContext> fsm(ctx);
+    state_machine<transitions, context, traced> fsm;
 
     fsm.start<start>("10.0.0.50", "user", "pass");
 
     // fsm.start<connecting>(); <- does not work due to operator()() design, good!
 
-    //fsm(exception("foo"));
+    //fsm(error_event(std::errc::io_error, "foo"));
     printf("terminated\n");
 }
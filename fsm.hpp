@@ -1,63 +1,1092 @@
 #pragma once
 
 #include <variant>
+#include <optional>
 #include <type_traits>
+#include <system_error>
+#include <utility>
 #include <cstdio>
 #include <functional>
 #include <thread>
 #include <chrono>
+#include <algorithm>
+#include <array>
+#include <new>
+#include <string_view>
+#include <cstdint>
+#include <cstring>
 
 #include "meta.hpp"
 #include "type_name.hpp"
+#include "inplace_function.hpp"
+#include "arena.hpp"
+
+// the guard and action of a plain row: always taken, nothing to do
+struct always {
+    template <typename State, typename Event>
+    constexpr bool operator()(const State &, const Event &) const noexcept { return true; }
+};
+
+struct no_action {
+    template <typename State, typename Event>
+    constexpr void operator()(State &, Event &) const noexcept {}
+};
 
 /*
- * transition just stores the types used in transitions
+ * transition just stores the types used in transitions. a row may add a
+ * Guard and an Action, default constructed and called inline by the
+ * machine, so they cost no more than the code they contain:
+ *
+ *   struct has_retries { bool operator()(const failed &s, const retry &) const { return s.left > 0; } };
+ *   struct count_retry { void operator()(failed &s, retry &) const { --s.left; } };
+ *
+ *   transition<failed, retry, connecting, has_retries, count_retry>
+ *
+ * guard(state, event) decides whether the row is taken. if it refuses, the
+ * next row for the same state and event is tried in table order, and if no
+ * row is left the event is unmatched and the state simply stays. action
+ * (state, event) runs when the row is taken, before the state is left.
  */
-template <typename Entry, typename Event, typename Next>
+template <typename Entry, typename Event, typename Next, typename Guard = always, typename Action = no_action>
 struct transition {
     using entry_state = Entry;
     using event       = Event;
     using next_state  = Next;
+    using guard       = Guard;
+    using action      = Action;
+
+    // the same row for other states, used when composites are flattened
+    template <typename E, typename N>
+    using rebind = transition<E, Event, N, Guard, Action>;
+};
+
+
+/*
+ * wildcard event for the table: transition<failed, any_event, failed> is
+ * taken for every event failed has no exact row for. the match is resolved
+ * at compile time and the next state still receives the concrete event, so
+ * its operator() has to accept it, typically as a template. in run-to-
+ * completion mode an event of a type outside the table waits in the queue
+ * like any other, in Policy::foreign_event_size bytes.
+ */
+struct any_event {};
+
+
+/*
+ * failure event without allocation: an error_code (as passed to the
+ * machine's Callback) and an optional context string. the context must be a
+ * string literal or otherwise outlive the event, it is never copied, so the
+ * whole event is a couple of words and trivially copyable.
+ *
+ *   cb(error_event(std::errc::connection_reset, "remote disconnect"));
+ */
+struct error_event {
+    error_event(std::error_code ec, const char *context = "") noexcept :
+        code(ec),
+        context(context)
+    {}
+
+    error_event(std::errc e, const char *context = "") noexcept :
+        error_event(std::make_error_code(e), context)
+    {}
+
+    std::error_code code;
+    const char *context;
+};
+
+
+/*
+ * dense [state][event] -> transition index table, built once per table at
+ * compile time. States and Events are the deduplicated lists extracted from
+ * the table; a pair without a row falls back to the state's any_event row,
+ * and maps to transition_count if there is none. when several rows share a
+ * pair, the first one wins.
+ */
+template <typename TransitionTable, typename States, typename Events>
+struct transition_lookup;
+
+template <template <class...> class TT, class ... Ts, typename States, typename Events>
+struct transition_lookup<TT<Ts...>, States, Events> {
+    static constexpr std::size_t transition_count = sizeof...(Ts);
+    static constexpr std::size_t state_count      = size_of_v<States>;
+    static constexpr std::size_t event_count      = size_of_v<Events>;
+    static constexpr std::size_t wildcard         = index_of_v<any_event, Events>;
+
+    static constexpr std::size_t entry[] = { index_of_v<typename Ts::entry_state, States>..., 0 };
+    static constexpr std::size_t event[] = { index_of_v<typename Ts::event, Events>..., 0 };
+
+    static constexpr auto table = [] {
+        std::array<std::array<std::size_t, event_count>, state_count> t{};
+        for (auto &row : t) {
+            for (auto &cell : row) {
+                cell = transition_count;
+            }
+        }
+        for (std::size_t i = transition_count; i-- > 0;) {
+            t[entry[i]][event[i]] = i;
+        }
+        return t;
+    }();
+
+    // the row after Row for the same state and event, tried when Row's guard refuses
+    template <std::size_t Row>
+    static constexpr std::size_t next_row = [] {
+        std::size_t i = Row + 1;
+        while (i < transition_count && (entry[i] != entry[Row] || event[i] != event[Row])) {
+            ++i;
+        }
+        return i;
+    }();
+
+    template <typename State, typename Event>
+    static constexpr std::size_t find() {
+        constexpr std::size_t s = index_of_v<State, States>;
+        constexpr std::size_t e = index_of_v<Event, Events>;
+        if constexpr (s == state_count) {
+            return transition_count;
+        } else if constexpr (e < event_count && table[s][e] < transition_count) {
+            return table[s][e];
+        } else if constexpr (wildcard < event_count) {
+            return table[s][wildcard];
+        } else {
+            return transition_count;
+        }
+    }
+};
+
+
+/*
+ * trace policies observe the machine. every hook is a template called with
+ * the compile-time state and event types, so the default no_trace inlines
+ * to nothing: no i/o, no sleeps and no allocations on the transition path.
+ */
+struct no_trace {
+    template <typename State, typename Event, typename Next>
+    void on_transition(const Event &) noexcept {}
+
+    template <typename State, typename Event>
+    void on_unmatched(const Event &) noexcept {}
+};
+
+/*
+ * a trace may also define
+ *
+ *   template <typename State> void on_start();
+ *   template <typename Event> void on_external(const Event &evt);
+ *
+ * to hear when start() enters StartState, e.g. to time the first state,
+ * and about every event pushed into the machine from outside, as opposed
+ * to those its states emit. both hooks are optional, traces without them
+ * are not affected. a trace that declares on_transition as
+ *
+ *   template <typename State, typename Event, typename Next, std::size_t Row>
+ *   void on_transition(const Event &evt);
+ *
+ * is also told the row of the flattened table that was taken, which the
+ * types alone do not pin down when guarded rows share a next state.
+ */
+namespace detail {
+    template <typename Trace, typename State, typename = void>
+    struct has_on_start : std::false_type {};
+
+    template <typename Trace, typename State>
+    struct has_on_start<Trace, State, std::void_t<decltype(std::declval<Trace &>().template on_start<State>())>>
+        : std::true_type {};
+
+    template <typename State, typename Trace>
+    void trace_start(Trace &trace) {
+        if constexpr (has_on_start<Trace, State>::value) {
+            trace.template on_start<State>();
+        }
+    }
+
+    template <typename Trace, typename Event, typename = void>
+    struct has_on_external : std::false_type {};
+
+    template <typename Trace, typename Event>
+    struct has_on_external<Trace, Event, std::void_t<decltype(std::declval<Trace &>().on_external(std::declval<const Event &>()))>>
+        : std::true_type {};
+
+    template <typename Trace, typename Event>
+    void trace_external(Trace &trace, const Event &evt) {
+        if constexpr (has_on_external<Trace, Event>::value) {
+            trace.on_external(evt);
+        }
+    }
+
+    template <typename Trace, typename State, typename Event, typename Next, std::size_t Row, typename = void>
+    struct has_on_transition_row : std::false_type {};
+
+    template <typename Trace, typename State, typename Event, typename Next, std::size_t Row>
+    struct has_on_transition_row<Trace, State, Event, Next, Row, std::void_t<decltype(
+        std::declval<Trace &>().template on_transition<State, Event, Next, Row>(std::declval<const Event &>()))>>
+        : std::true_type {};
+
+    template <typename State, typename Event, typename Next, std::size_t Row, typename Trace>
+    void trace_transition(Trace &trace, const Event &evt) {
+        if constexpr (has_on_transition_row<Trace, State, Event, Next, Row>::value) {
+            trace.template on_transition<State, Event, Next, Row>(evt);
+        } else {
+            trace.template on_transition<State, Event, Next>(evt);
+        }
+    }
+
+    template <typename Callable, typename Event, typename = void>
+    struct has_external : std::false_type {};
+
+    template <typename Callable, typename Event>
+    struct has_external<Callable, Event, std::void_t<decltype(std::declval<Callable &>().external(std::declval<Event>()))>>
+        : std::true_type {};
+
+    // evt through a state's callback as an event from outside the machine,
+    // traced like push(), if the callback can tell the two apart
+    template <typename Callable, typename Event>
+    void emit_external(Callable &cb, Event &&evt) {
+        if constexpr (has_external<Callable, Event>::value) {
+            cb.external(std::forward<Event>(evt));
+        } else {
+            cb(std::forward<Event>(evt));
+        }
+    }
+}
+
+// prints every transition and every unmatched event to stdout. names are
+// compile-time string_views, so the only cost left is the printf itself
+struct printf_trace {
+    template <typename State, typename Event, typename Next>
+    void on_transition(const Event &) {
+        constexpr std::string_view s = type_name<State>(), e = type_name<Event>(), n = type_name<Next>();
+        printf("[%.*s + %.*s > %.*s]\n", int(s.size()), s.data(), int(e.size()), e.data(), int(n.size()), n.data());
+    }
+
+    template <typename State, typename Event>
+    void on_unmatched(const Event &) {
+        constexpr std::string_view s = type_name<State>(), e = type_name<Event>();
+        printf("no transition for: %.*s + %.*s\n", int(s.size()), s.data(), int(e.size()), e.data());
+    }
+};
+
+// wraps another trace and sleeps after each transition, handy for watching a demo
+template <typename Trace = printf_trace, unsigned Milliseconds = 1000>
+struct paced_trace : Trace {
+    template <typename State, typename Event, typename Next, std::size_t Row>
+    void on_transition(const Event &evt) {
+        detail::trace_transition<State, Event, Next, Row>(static_cast<Trace &>(*this), evt);
+        std::this_thread::sleep_for(std::chrono::milliseconds(Milliseconds));
+    }
+};
+
+
+/*
+ * dispatch backends select how push() finds the current state:
+ *   visit_dispatch  - std::visit over the state variant
+ *   switch_dispatch - a fold over the state indices, which compilers lower
+ *                     to a switch on m_state->index() with inlined cases
+ *   table_dispatch  - a constexpr array of member pointers per event type,
+ *                     indexed by m_state->index()
+ */
+struct visit_dispatch {};
+struct switch_dispatch {};
+struct table_dispatch {};
+
+
+/*
+ * a state normally replaces the previous one in place: the old alternative
+ * is destroyed first and the next one is constructed from the context
+ * directly in the variant storage. a state that really needs to look at its
+ * predecessor opts in by also taking a previous<State> constructor argument,
+ *
+ *   connected(Context &ctx, previous<connecting> prev);
+ *
+ * which costs one temporary and a move for that transition only.
+ */
+template <typename State>
+struct previous {
+    State &state;
+};
+
+
+/*
+ * a state may take events itself before the table is consulted by defining
+ *
+ *   template <typename Event, typename Callable>
+ *   bool accept(Event &evt, Callable &&cb);
+ *
+ * returning true means the event was consumed and no transition happens.
+ * this is what lets a coroutine state (fsm_coro.hpp) wait for its next
+ * event without leaving the state. in run-to-completion mode an emitted
+ * event of a type no row lists is queued behind the others when accept()
+ * is a template over the event, as it is for coroutine states. one accepted
+ * by a non-template accept() only has to be listed in a row to be queued
+ * too, otherwise it is dispatched as soon as it is emitted.
+ */
+namespace detail {
+    template <typename State, typename Event, typename Callable, typename = void>
+    struct has_accept : std::false_type {};
+
+    template <typename State, typename Event, typename Callable>
+    struct has_accept<State, Event, Callable,
+                      std::void_t<decltype(std::declval<State &>().accept(std::declval<Event &>(), std::declval<Callable>()))>>
+        : std::true_type {};
+
+    // whether any of States has an accept() for Event
+    template <typename Event, typename Callable, typename States>
+    struct any_accept;
+
+    template <typename Event, typename Callable, template <class...> class TT, class ... States>
+    struct any_accept<Event, Callable, TT<States...>>
+        : std::bool_constant<(has_accept<States, Event, Callable>::value || ...)> {};
+
+    // stand-ins for an event type no table lists and for a state's callback,
+    // only a template accept() takes them
+    struct unlisted_event {};
+
+    struct any_callback {
+        template <typename Event>
+        void operator()(Event &&) const {}
+    };
+}
+
+
+/*
+ * non-owning handle to the context of a state_machine. copying it is a
+ * pointer copy, so states can hold on to it without any refcount traffic.
+ * it converts to Context &, states may take either.
+ */
+template <typename Context>
+class context_ref {
+public:
+    context_ref(Context &ctx) : m_ctx(&ctx) {}
+
+    Context &get() const { return *m_ctx; }
+    operator Context &() const { return *m_ctx; }
+    Context &operator*() const { return *m_ctx; }
+    Context *operator->() const { return m_ctx; }
+
+private:
+    Context *m_ctx;
+};
+
+namespace detail {
+    // a machine whose states hold context_refs into it can be neither
+    // copied nor moved, the copy's states would still point at the original
+    template <bool Pinned>
+    struct pinned {};
+
+    template <>
+    struct pinned<true> {
+        pinned() = default;
+        pinned(const pinned &) = delete;
+        pinned &operator=(const pinned &) = delete;
+    };
+}
+
+
+/*
+ * per-machine bump allocation for state buffers and event payloads. a state
+ * opts in by taking the arena right after the context,
+ *
+ *   receiver(context_ref<context> ctx, monotonic_arena &arena);
+ *
+ * and allocates through it, e.g. with arena_allocator. transition_arena
+ * keeps two regions of Size bytes: the states entered since the last swap
+ * and the events they emit use the current one. at each transition the
+ * machine swaps to the other region and releases it in bulk, unless events
+ * emitted from it are still queued; then it keeps bumping the current one.
+ * the state being left and the event being dispatched always live in the
+ * region that is kept.
+ *
+ * releasing is only safe because emitted events are queued, so the arena
+ * requires queue_capacity > 0. memory is valid until the state after the
+ * next one is entered: a state keeps what it needs longer by copying it
+ * into its own arena allocation.
+ */
+struct no_arena {
+    void restart() noexcept {}
+    void on_queued() noexcept {}
+    void on_dequeued() noexcept {}
+    void on_transition() noexcept {}
+};
+
+template <std::size_t Size = 4096>
+class transition_arena {
+public:
+    monotonic_arena &region() { return m_regions[m_current]; }
+
+    // heap fallbacks of both regions so far
+    std::size_t overflows() const { return m_regions[0].overflows() + m_regions[1].overflows(); }
+
+    void restart() {
+        m_regions[0].release();
+        m_regions[1].release();
+        m_pending[0] = m_pending[1] = 0;
+        m_current = 0;
+    }
+
+    void on_queued() { ++m_pending[m_current]; }
+
+    // the queue only ever holds events of the other region ahead of those
+    // of the current one, so the front belongs to the other while it has any
+    void on_dequeued() { --m_pending[m_pending[m_current ^ 1] > 0 ? m_current ^ 1 : m_current]; }
+
+    void on_transition() {
+        if (m_pending[m_current ^ 1] == 0) {
+            m_current ^= 1;
+            m_regions[m_current].release();
+        }
+    }
+
+private:
+    inline_arena<Size> m_regions[2];
+    std::size_t m_pending[2] = {0, 0};
+    unsigned m_current = 0;
+};
+
+
+/*
+ * state storage of a state_machine:
+ *
+ *   optional_storage              std::optional<std::variant<States...>>.
+ *                                 the optional's engaged flag comes on top
+ *                                 of the variant's own index, padded to
+ *                                 the alignment of the largest state
+ *   compact_storage<OutOfLine>    a raw buffer for the largest state and
+ *                                 one index of the smallest unsigned type
+ *                                 that fits, one value of which means "not
+ *                                 started". states bigger than OutOfLine
+ *                                 bytes (0: none) live out of line and
+ *                                 only their pointer is stored, so one
+ *                                 rarely visited big state does not size
+ *                                 every machine
+ *
+ * out-of-line states come from a free list per type and thread, refilled
+ * from the heap, so entering them allocates only until the list is warm.
+ * a machine with compact_storage can be neither copied nor moved.
+ */
+namespace detail {
+    // recycles the memory of out-of-line states of type T on this thread
+    template <typename T>
+    class state_pool {
+    public:
+        static_assert(alignof(T) <= alignof(std::max_align_t), "out-of-line states must not be over-aligned");
+
+        static void *allocate() {
+            node *&head = list().head;
+            if (node *n = head) {
+                head = n->next;
+                return n;
+            }
+            return ::operator new(std::max(sizeof(T), sizeof(node)));
+        }
+
+        static void deallocate(void *p) noexcept {
+            node *&head = list().head;
+            head = ::new (p) node{head};
+        }
+
+    private:
+        struct node {
+            node *next;
+        };
+
+        struct free_list {
+            ~free_list() {
+                while (node *n = head) {
+                    head = n->next;
+                    ::operator delete(n);
+                }
+            }
+
+            node *head = nullptr;
+        };
+
+        static free_list &list() {
+            thread_local free_list l;
+            return l;
+        }
+    };
+
+    template <typename States>
+    class optional_states;
+
+    template <typename ... Ss>
+    class optional_states<std::variant<Ss...>> {
+    public:
+        std::size_t index() const { return m_state ? m_state->index() : std::variant_npos; }
+
+        void reset() { m_state.reset(); }
+
+        template <typename T, typename ... Args>
+        T &emplace(Args && ... args) {
+            if (m_state) {
+                return m_state->template emplace<T>(std::forward<Args>(args)...);
+            }
+            return std::get<T>(m_state.emplace(std::in_place_type<T>, std::forward<Args>(args)...));
+        }
+
+        // a pointer to the state if it is alternative I
+        template <std::size_t I>
+        auto *get_if() { return m_state ? std::get_if<I>(&*m_state) : nullptr; }
+
+        template <std::size_t I>
+        auto *get_if() const { return m_state ? std::get_if<I>(&*m_state) : nullptr; }
+
+        // std::bad_optional_access before start()
+        template <typename F>
+        void visit(F && f) { std::visit(std::forward<F>(f), m_state.value()); }
+
+    private:
+        std::optional<std::variant<Ss...>> m_state;
+    };
+
+    template <typename States, std::size_t OutOfLine>
+    class compact_states;
+
+    template <std::size_t OutOfLine, typename ... Ss>
+    class compact_states<std::variant<Ss...>, OutOfLine> {
+        using alternatives = std::variant<Ss...>;
+
+        template <typename T>
+        static constexpr bool out_of_line = OutOfLine > 0 && sizeof(T) > OutOfLine;
+
+        template <typename T>
+        static constexpr std::size_t stored_size = out_of_line<T> ? sizeof(T *) : sizeof(T);
+
+        template <typename T>
+        static constexpr std::size_t stored_align = out_of_line<T> ? alignof(T *) : alignof(T);
+
+    public:
+        using index_type = smallest_unsigned_t<sizeof...(Ss)>;
+        static constexpr index_type not_started = sizeof...(Ss);
+
+        compact_states() = default;
+        compact_states(const compact_states &) = delete;
+        compact_states &operator=(const compact_states &) = delete;
+
+        ~compact_states() { reset(); }
+
+        std::size_t index() const { return m_index == not_started ? std::variant_npos : m_index; }
+
+        void reset() {
+            reset_indexed(std::index_sequence_for<Ss...>());
+            m_index = not_started;
+        }
+
+        // the old state is gone first. if T's constructor throws, the
+        // storage is left not started
+        template <typename T, typename ... Args>
+        T &emplace(Args && ... args) {
+            reset();
+            T *state;
+            if constexpr (out_of_line<T>) {
+                void *p = state_pool<T>::allocate();
+                try {
+                    state = ::new (p) T(std::forward<Args>(args)...);
+                } catch (...) {
+                    state_pool<T>::deallocate(p);
+                    throw;
+                }
+                ::new (static_cast<void *>(m_storage)) T *(state);
+            } else {
+                state = ::new (static_cast<void *>(m_storage)) T(std::forward<Args>(args)...);
+            }
+            m_index = static_cast<index_type>(index_of_v<T, alternatives>);
+            return *state;
+        }
+
+        template <std::size_t I>
+        auto *get_if() {
+            using T = std::variant_alternative_t<I, alternatives>;
+            return m_index == I ? &get<T>() : static_cast<T *>(nullptr);
+        }
+
+        template <std::size_t I>
+        auto *get_if() const {
+            using T = std::variant_alternative_t<I, alternatives>;
+            return m_index == I ? &const_cast<compact_states &>(*this).template get<T>() : static_cast<const T *>(nullptr);
+        }
+
+        // std::bad_variant_access before start()
+        template <typename F>
+        void visit(F && f) {
+            if (m_index == not_started) {
+                throw std::bad_variant_access();
+            }
+            visit_indexed(f, std::index_sequence_for<Ss...>());
+        }
+
+    private:
+        template <typename T>
+        T &get() {
+            if constexpr (out_of_line<T>) {
+                return **std::launder(reinterpret_cast<T **>(m_storage));
+            } else {
+                return *std::launder(reinterpret_cast<T *>(m_storage));
+            }
+        }
+
+        template <typename T>
+        void destroy() {
+            T &state = get<T>();
+            state.~T();
+            if constexpr (out_of_line<T>) {
+                state_pool<T>::deallocate(&state);
+            }
+        }
+
+        template <std::size_t ... Is>
+        void reset_indexed(std::index_sequence<Is...>) {
+            (void)((m_index == Is && (destroy<Ss>(), true)) || ...);
+        }
+
+        template <typename F, std::size_t ... Is>
+        void visit_indexed(F & f, std::index_sequence<Is...>) {
+            (void)((m_index == Is && (f(get<Ss>()), true)) || ...);
+        }
+
+        alignas(stored_align<Ss>...) unsigned char m_storage[std::max({ stored_size<Ss>... })];
+        index_type m_index = not_started;
+    };
+}
+
+struct optional_storage {
+    template <typename States>
+    using type = detail::optional_states<States>;
+};
+
+template <std::size_t OutOfLine = 0>
+struct compact_storage {
+    template <typename States>
+    using type = detail::compact_states<States, OutOfLine>;
+};
+
+
+/*
+ * sizeof of every state in States, known at compile time, e.g.
+ *
+ *   state_sizes<fsm::states>::print();
+ *
+ * to see which states decide the size of a machine before picking
+ * compact_storage<OutOfLine>.
+ */
+template <typename States>
+struct state_sizes;
+
+template <typename ... Ss>
+struct state_sizes<std::variant<Ss...>> {
+    static constexpr std::array<std::size_t, sizeof...(Ss)> sizes = {{ sizeof(Ss)... }};
+    static constexpr std::size_t largest = std::max({ sizeof(Ss)... });
+
+    static void print(std::FILE *out = stdout) {
+        constexpr std::string_view names[] = { type_name<Ss>()... };
+        for (std::size_t i = 0; i < sizeof...(Ss); ++i) {
+            std::fprintf(out, "%6zu  %.*s\n", sizes[i], int(names[i].size()), names[i].data());
+        }
+    }
+};
+
+
+/*
+ * a machine can be written to a flat binary record and restored from it,
+ * e.g. to move sessions off a draining node into another process of the
+ * same build. a state whose data should survive provides a trivially
+ * copyable snapshot_type, a way to produce it and a constructor taking
+ * it back:
+ *
+ *   struct connected {
+ *       struct snapshot_type { int fd; std::uint64_t seq; };
+ *
+ *       connected(context_ref<context> ctx, const snapshot_type &s);
+ *       snapshot_type snapshot() const;
+ *   };
+ *
+ * any other state is recorded by its index only and restored from the
+ * context alone, so it must be constructible from context_arg. a record is
+ * a snapshot_header followed by the snapshot_type bytes, never longer than
+ * the machine's snapshot_size, so the records of many machines fit one
+ * preallocated buffer of fixed-size slots. the header carries a version and
+ * a hash of the machine's state types; restore() rejects records written
+ * by another version or for another set of states.
+ */
+struct snapshot_header {
+    std::uint32_t magic;
+    std::uint16_t version;
+    std::uint16_t state;        // index into the machine's states
+    std::uint32_t states_hash;
+    std::uint32_t size;         // snapshot_type bytes after the header
 };
 
+inline constexpr std::uint32_t snapshot_magic   = 0x534d5346;    // "FSMS"
+inline constexpr std::uint16_t snapshot_version = 1;
 
-namespace {
-template <typename T, typename U, typename V>
-constexpr bool equals() {
-    return (std::is_same_v<typename T::entry_state, U>) && (std::is_same_v<typename T::event, V>);
+namespace detail {
+    template <typename State, typename = void>
+    struct snapshot_of {
+        static constexpr std::size_t size = 0;
+    };
+
+    template <typename State>
+    struct snapshot_of<State, std::void_t<typename State::snapshot_type>> {
+        using type = typename State::snapshot_type;
+        static_assert(std::is_trivially_copyable_v<type>, "snapshot_type must be trivially copyable");
+        static constexpr std::size_t size = sizeof(type);
+    };
+
+    template <typename State, typename = void>
+    struct has_snapshot : std::false_type {};
+
+    template <typename State>
+    struct has_snapshot<State, std::void_t<typename State::snapshot_type>> : std::true_type {};
+
+    template <typename States>
+    struct max_snapshot;
+
+    template <typename ... Ss>
+    struct max_snapshot<std::variant<Ss...>> {
+        static constexpr std::size_t value = std::max({ std::size_t(0), snapshot_of<Ss>::size... });
+    };
+
+    // fnv-1a over the type names, each terminated by a 0
+    template <typename States>
+    struct states_hash;
+
+    template <typename ... Ss>
+    struct states_hash<std::variant<Ss...>> {
+        static constexpr std::uint32_t value = [] {
+            std::uint32_t h = 2166136261u;
+            for (std::string_view name : { type_name<Ss>()... }) {
+                for (char c : name) {
+                    h = (h ^ static_cast<unsigned char>(c)) * 16777619u;
+                }
+                h = h * 16777619u;
+            }
+            return h;
+        }();
+    };
 }
 
-template<typename VariantType, typename U, typename V, std::size_t index = 0>
-constexpr std::size_t match() {
-    if constexpr (index == std::variant_size_v<VariantType>) {
-        return index;
-    } else if constexpr (equals<std::variant_alternative_t<index, VariantType>, U, V>()) {
-        return index;
-    } else {
-        return match<VariantType, U, V, index + 1>();
+
+/*
+ * compile-time knobs of a state_machine. derive from default_policy and
+ * override what you need, e.g.
+ *
+ *   struct traced : default_policy { using trace = printf_trace; };
+ *   state_machine<transitions, context, traced> fsm;
+ */
+struct default_policy {
+    using trace = no_trace;
+
+    // 0 dispatches events emitted by state callbacks recursively, N > 0 queues
+    // up to N of them and drains them in a flat run-to-completion loop
+    static constexpr std::size_t queue_capacity = 0;
+
+    using dispatch = visit_dispatch;
+
+    /*
+     * false: states are constructed from the machine's Context lvalue and
+     * may copy it, e.g. a std::shared_ptr<context> they keep. true: the
+     * machine owns the one Context and states get a context_ref<Context>;
+     * a state that would copy the context (by-value or const & parameter)
+     * fails to compile, and so does copying or moving the machine.
+     */
+    static constexpr bool context_by_reference = false;
+
+    // completion handler, stored in the machine without heap allocation
+    using callback = inplace_function<void(const std::error_code &ec), 32>;
+
+    // no_arena, or transition_arena<Size> to hand states a per-machine arena
+    using arena = no_arena;
+
+    // optional_storage, or compact_storage<OutOfLine> for smaller machines
+    using storage = optional_storage;
+
+    // bytes the queue keeps for an event whose type is not in the table,
+    // one only an any_event row can take
+    static constexpr std::size_t foreign_event_size = 32;
+};
+
+
+/*
+ * fixed-capacity ring of pending events, stored inside the state_machine.
+ * the front slot stays occupied while it is being dispatched so callbacks
+ * can keep appending behind it without moving anything.
+ */
+template <typename Variant, std::size_t Capacity>
+class event_queue {
+public:
+    bool empty() const { return m_size == 0; }
+
+    template <typename Event>
+    bool push(Event && evt) {
+        return emplace(std::in_place_type<std::decay_t<Event>>, std::forward<Event>(evt));
+    }
+
+    template <typename ... Args>
+    bool emplace(Args && ... args) {
+        if (m_size == Capacity) {
+            return false;
+        }
+        m_slots[(m_head + m_size) % Capacity].emplace(std::forward<Args>(args)...);
+        ++m_size;
+        return true;
+    }
+
+    Variant &front() { return *m_slots[m_head]; }
+
+    void pop() {
+        m_slots[m_head].reset();
+        m_head = (m_head + 1) % Capacity;
+        --m_size;
     }
+
+private:
+    std::optional<Variant> m_slots[Capacity];
+    std::size_t m_head = 0;
+    std::size_t m_size = 0;
+};
+
+// recursive dispatch needs no queue at all
+template <typename Variant>
+class event_queue<Variant, 0> {};
+
+namespace detail {
+    /*
+     * a queued event of a type outside the table's event list: the event in
+     * Size bytes and the function that dispatches it, called with Args. the
+     * queue constructs and destroys it in place, it is never copied or moved.
+     */
+    template <std::size_t Size, typename ... Args>
+    class foreign_event {
+    public:
+        using dispatch_type = void (*)(void *, Args...);
+
+        template <typename Event>
+        foreign_event(Event && evt, dispatch_type dispatch) :
+            m_dispatch(dispatch),
+            m_destroy(&destroy_as<std::decay_t<Event>>)
+        {
+            using T = std::decay_t<Event>;
+            static_assert(sizeof(T) <= Size, "event too large to queue, raise the policy's foreign_event_size");
+            static_assert(alignof(std::max_align_t) % alignof(T) == 0, "event over-aligned for the queue");
+            ::new (static_cast<void *>(m_storage)) T(std::forward<Event>(evt));
+        }
+
+        foreign_event(const foreign_event &) = delete;
+        foreign_event &operator=(const foreign_event &) = delete;
+
+        ~foreign_event() { m_destroy(m_storage); }
+
+        void dispatch(Args ... args) { m_dispatch(m_storage, args...); }
+
+    private:
+        template <typename T>
+        static void destroy_as(void *p) { static_cast<T *>(p)->~T(); }
+
+        alignas(std::max_align_t) unsigned char m_storage[Size];
+        dispatch_type m_dispatch;
+        void (*m_destroy)(void *);
+    };
+}
+
+
+/*
+ * composite states group states that share rows. a composite is only a
+ * name in the table, never a state of its own:
+ *
+ *   struct online : composite<start, connecting, connected> {};
+ *
+ *   transition<online, error_event, failed>    // one row for all three
+ *   transition<failed, retry,       online>    // enters start, the first child
+ *
+ * composites may nest. flatten_table_t expands every row at compile time
+ * into one row per leaf state, so the machine only ever sees a flat table
+ * and dispatch stays a single lookup. a state's own rows come first and win
+ * over inherited ones; among inherited rows the one listed first wins, so
+ * list rows of inner composites before those of outer ones.
+ */
+template <typename ... Children>
+struct composite {
+    using composite_children = std::tuple<Children...>;
+};
+
+namespace detail {
+    template <typename T, typename = void>
+    struct is_composite : std::false_type {};
+
+    template <typename T>
+    struct is_composite<T, std::void_t<typename T::composite_children>> : std::true_type {};
+
+    template <typename List>
+    struct leaves_of;
+
+    // the leaf states below T, T itself for a plain state
+    template <typename T, bool = is_composite<T>::value>
+    struct leaves {
+        using type = type_list<T>;
+    };
+
+    template <typename T>
+    struct leaves<T, true> : leaves_of<typename T::composite_children> {};
+
+    template <typename ... Cs>
+    struct leaves_of<std::tuple<Cs...>> {
+        using type = concat_t<typename leaves<Cs>::type...>;
+    };
+
+    // entering a composite enters its first child
+    template <typename T, bool = is_composite<T>::value>
+    struct initial {
+        using type = T;
+    };
+
+    template <typename T>
+    struct initial<T, true> : initial<std::tuple_element_t<0, typename T::composite_children>> {};
+
+    template <typename Row, typename Leaves>
+    struct rows_for;
+
+    template <typename Row, typename ... Ls>
+    struct rows_for<Row, type_list<Ls...>> {
+        using type = type_list<typename Row::template rebind<Ls, typename initial<typename Row::next_state>::type>...>;
+    };
+
+    // the leaf rows of Row if its entry is a composite (Inherited) or not
+    template <typename Row, bool Inherited>
+    using expanded_rows_t = std::conditional_t<is_composite<typename Row::entry_state>::value == Inherited,
+                                               typename rows_for<Row, typename leaves<typename Row::entry_state>::type>::type,
+                                               type_list<>>;
 }
 
-} // namespace anon
+template <typename TransitionTable>
+struct flatten_table;
+
+template <template <class...> class TT, class ... Rows>
+struct flatten_table<TT<Rows...>> {
+    using type = typename detail::rebind_list<TT, detail::concat_t<
+        detail::expanded_rows_t<Rows, false>...,
+        detail::expanded_rows_t<Rows, true>...>>::type;
+};
+
+template <typename TransitionTable>
+using flatten_table_t = typename flatten_table<TransitionTable>::type;
+
 
+// a table's states and events, duplicates kept. a trait, not a function
+// deduced from a table argument: deducing TT<Ts...> that way makes the
+// compiler complete the table's std::variant, which for a long table costs
+// more than everything else here
+template <typename TransitionTable>
+struct extract_lists;
 
 template <template <class...> class TT, class ... Ts>
-auto extract_states(TT<Ts...>)
--> TT<typename Ts::entry_state..., typename Ts::next_state...>;
+struct extract_lists<TT<Ts...>> {
+    using states = TT<typename Ts::entry_state..., typename Ts::next_state...>;
+    using events = TT<typename Ts::event...>;
+};
 
 
-template <typename TransitionTable, typename Context = bool>
-class state_machine {
+template <typename TransitionTable, typename Context = bool, typename Policy = default_policy>
+class state_machine : detail::pinned<Policy::context_by_reference> {
 public:
+    using trace_type = typename Policy::trace;
+    using dispatch_type = typename Policy::dispatch;
+
+    // the table as written, with composite rows expanded per leaf state
+    using transition_table = flatten_table_t<TransitionTable>;
+
+    using states = remove_duplicates_t<typename extract_lists<transition_table>::states>;
+    using events = remove_duplicates_t<typename extract_lists<transition_table>::events>;
+
+    static constexpr std::size_t queue_capacity = Policy::queue_capacity;
+    static constexpr bool context_by_reference = Policy::context_by_reference;
+
+    // what state constructors receive as their first argument
+    using context_arg = std::conditional_t<context_by_reference, context_ref<Context>, Context &>;
 
-    using extracted = decltype(extract_states(std::declval<TransitionTable>()));
-    using states = remove_duplicates_t<extracted>;
+    // the state constructor contract, checked for every state the machine enters
+    template <typename State, typename ... Args>
+    static constexpr bool accepts_context() {
+        if constexpr (context_by_reference) {
+            return std::is_constructible_v<State, context_arg, Args...> &&
+                  !std::is_constructible_v<State, Context &&, Args...>;
+        } else {
+            return std::is_constructible_v<State, context_arg, Args...>;
+        }
+    }
+
+    using state_storage = typename Policy::storage::template type<states>;
+
+    using arena_type = typename Policy::arena;
+    static constexpr bool has_arena = !std::is_same_v<arena_type, no_arena>;
+    static_assert(!has_arena || queue_capacity > 0, "the transition arena needs the run-to-completion queue (queue_capacity > 0)");
+
+    // State takes (context_arg, monotonic_arena &, args...)
+    template <typename State, typename ... Args>
+    static constexpr bool takes_arena() {
+        if constexpr (has_arena) {
+            return accepts_context<State, monotonic_arena &, Args...>();
+        } else {
+            return false;
+        }
+    }
 
-    static constexpr size_t state_count = std::variant_size_v<TransitionTable>;
+    // with or without the arena
+    template <typename State, typename ... Args>
+    static constexpr bool constructible() {
+        return accepts_context<State, Args...>() || takes_arena<State, Args...>();
+    }
+
+    static constexpr size_t state_count = std::variant_size_v<transition_table>;
     static_assert(state_count > 1, "no state transitions in table");
 
+    using lookup = transition_lookup<transition_table, states, events>;
+    static constexpr std::size_t transition_count = lookup::transition_count;
+
+    // whether an event outside the table's event list can take a row at all
+    static constexpr bool has_wildcard = lookup::wildcard < lookup::event_count;
+
+    // whether a state's accept() takes events of any type, listed or not
+    static constexpr bool accepts_unlisted = detail::any_accept<detail::unlisted_event, detail::any_callback, states>::value;
+
+    // what the run-to-completion queue holds: the table's events, plus one
+    // type-erased slot for the others when an any_event row or an accept()
+    // can take them
+    using foreign_type = detail::foreign_event<Policy::foreign_event_size, state_machine &>;
+    using queued_events = std::conditional_t<queue_capacity != 0 && (has_wildcard || accepts_unlisted),
+                                             merge_t<std::variant, events, std::variant<foreign_type>>, events>;
+
+    // index of the row taken for State + Event, transition_count if there is none
+    template <typename State, typename Event>
+    static constexpr std::size_t transition_index = lookup::template find<State, Event>();
+
+    /*
+     * evaluates the guards of the candidate rows from Row on and calls
+     * take(std::integral_constant<std::size_t, I>()) with the first row
+     * that passes. false if every guard refused. unguarded rows compile
+     * down to the call.
+     */
+    template <std::size_t Row, typename State, typename Event, typename Take>
+    static bool select_row(const State & current_state, const Event & evt, Take && take) {
+        using row = std::variant_alternative_t<Row, transition_table>;
+        if (typename row::guard()(current_state, evt)) {
+            take(std::integral_constant<std::size_t, Row>());
+            return true;
+        }
+        if constexpr (lookup::template next_row<Row> < transition_count) {
+            return select_row<lookup::template next_row<Row>>(current_state, evt, std::forward<Take>(take));
+        } else {
+            return false;
+        }
+    }
+
     state_machine(Context c = Context()) :
-        m_ctx(c)
+        m_ctx(std::move(c))
+    {}
+
+    // builds the context in place, for contexts that cannot be copied or moved
+    template <typename ... Args>
+    explicit state_machine(std::in_place_t, Args && ... args) :
+        m_ctx(std::forward<Args>(args)...)
     {
 //        printf("transitions in table: %zd\n", state_count);
 //        printf("unique transitions: %zd\n", std::variant_size_v<states>);
@@ -65,77 +1094,429 @@ public:
 
 
 
-    using Callback = std::function<void(const std::error_code &ec)>;
+    using Callback = typename Policy::callback;
+
+    // invoked for events no transition accepts and when the event queue overflows
+    void set_callback(Callback cb) { m_cb = std::move(cb); }
+
+    trace_type &trace() { return m_trace; }
+    Context &context() { return m_ctx; }
+    arena_type &arena() { return m_arena; }
+
+    // the longest record snapshot() writes for this table
+    static constexpr std::size_t snapshot_size = sizeof(snapshot_header) + detail::max_snapshot<states>::value;
+
+    /*
+     * writes the current state as one record, returns its size. 0 if the
+     * machine is not started, the state can not be restored or capacity is
+     * too small. not to be called from inside a state callback.
+     */
+    std::size_t snapshot(void *buf, std::size_t capacity) const {
+        return snapshot_indexed(static_cast<unsigned char *>(buf), capacity, std::make_index_sequence<size_of_v<states>>());
+    }
+
+    /*
+     * replaces the current state with the one recorded, constructed in
+     * place with this machine's context. the state is not entered again,
+     * its operator() does not run. false if the record is truncated or
+     * from another version or table, the machine is unchanged then.
+     */
+    bool restore(const void *buf, std::size_t size) {
+        snapshot_header header;
+        if (size < sizeof(header)) {
+            return false;
+        }
+        std::memcpy(&header, buf, sizeof(header));
+        if (header.magic != snapshot_magic || header.version != snapshot_version ||
+            header.states_hash != detail::states_hash<states>::value || header.state >= size_of_v<states> ||
+            size - sizeof(header) < header.size) {
+            return false;
+        }
+        return restore_indexed(header, static_cast<const unsigned char *>(buf) + sizeof(header), std::make_index_sequence<size_of_v<states>>());
+    }
 
     template <typename StartState, typename ... Args>
     void start(Args && ... args) {
-        m_state = StartState(m_ctx, std::forward<Args>(args)...);
-        std::get<StartState>(*m_state)([this](auto && arg){
-            push(arg);
-        });
+        static_assert(constructible<StartState, Args...>(),
+                      "state must be constructible from (context_arg, args...) without copying a by-reference context");
+        if constexpr (has_arena) {
+            m_state.reset();
+            m_arena.restart();
+        }
+        StartState &state = with_arguments<StartState>([this](auto && ... a) -> StartState & {
+            return m_state.template emplace<StartState>(std::forward<decltype(a)>(a)...);
+        }, std::forward<Args>(args)...);
+        detail::trace_start<StartState>(m_trace);
+        if constexpr (queue_capacity == 0) {
+            state(emitter());
+        } else {
+            run_guard guard(m_running);
+            state(emitter());
+            drain_queue();
+        }
     }
 
 protected:
-    template <typename Event>
-    void push(Event evt) {
-
-        std::visit([&](auto && current_state){
-            using current_state_type = std::decay_t<decltype(current_state)>;
-//            printf("*** current state is: %s, event is: %s ***\n",
-//                   type_name<current_state_type>().c_str(),
-//                   type_name<Event>().c_str()
-//                   );
-
-            if constexpr(std::variant_size_v<TransitionTable> > match<TransitionTable, current_state_type, Event>()) {
-                //using transition_state_type = std::variant_alternative_t<match<TransitionTable, current_state_type, Event>(), TransitionTable>;
-                //using next_state_type       = typename transition_state_type::next_state;
-                process(current_state, evt);
+    // recorded by snapshot_type, or by index and rebuilt from the context
+    template <typename State>
+    static constexpr bool restorable() {
+        if constexpr (detail::has_snapshot<State>::value) {
+            return constructible<State, const typename State::snapshot_type &>();
+        } else {
+            return constructible<State>();
+        }
+    }
+
+    template <std::size_t ... Is>
+    std::size_t snapshot_indexed(unsigned char *buf, std::size_t capacity, std::index_sequence<Is...>) const {
+        std::size_t written = 0;
+        (void)((m_state.index() == Is && (written = snapshot_as<Is>(buf, capacity), true)) || ...);
+        return written;
+    }
+
+    template <std::size_t I>
+    std::size_t snapshot_as(unsigned char *buf, std::size_t capacity) const {
+        using State = std::variant_alternative_t<I, states>;
+        constexpr std::size_t size = detail::snapshot_of<State>::size;
+
+        if constexpr (!restorable<State>()) {
+            return 0;
+        } else {
+            if (capacity < sizeof(snapshot_header) + size) {
+                return 0;
+            }
+            const snapshot_header header{snapshot_magic, snapshot_version, std::uint16_t(I),
+                                         detail::states_hash<states>::value, std::uint32_t(size)};
+            std::memcpy(buf, &header, sizeof(header));
+            if constexpr (detail::has_snapshot<State>::value) {
+                const typename State::snapshot_type payload = m_state.template get_if<I>()->snapshot();
+                std::memcpy(buf + sizeof(header), &payload, size);
+            }
+            return sizeof(header) + size;
+        }
+    }
+
+    template <std::size_t ... Is>
+    bool restore_indexed(const snapshot_header &header, const unsigned char *payload, std::index_sequence<Is...>) {
+        bool restored = false;
+        (void)((header.state == Is && (restored = restore_as<Is>(header, payload), true)) || ...);
+        return restored;
+    }
+
+    template <std::size_t I>
+    bool restore_as(const snapshot_header &header, const unsigned char *payload) {
+        using State = std::variant_alternative_t<I, states>;
+
+        if constexpr (!restorable<State>()) {
+            return false;
+        } else {
+            if (header.size != detail::snapshot_of<State>::size) {
+                return false;
+            }
+            if constexpr (has_arena) {
+                m_state.reset();
+                m_arena.restart();
+            }
+            if constexpr (detail::has_snapshot<State>::value) {
+                typename State::snapshot_type s;
+                std::memcpy(&s, payload, sizeof(s));
+                with_arguments<State>([this](auto && ... a) {
+                    m_state.template emplace<State>(std::forward<decltype(a)>(a)...);
+                }, std::as_const(s));
             } else {
-                printf("no transition for: %s + %s\n", type_name<current_state_type>().c_str(), type_name<Event>().c_str());
-                if (m_cb) {
-                    m_cb({});
+                with_arguments<State>([this](auto && ... a) {
+                    m_state.template emplace<State>(std::forward<decltype(a)>(a)...);
+                });
+            }
+            return true;
+        }
+    }
+
+    // calls f with State's constructor arguments: the context, the arena
+    // region if State takes it, then args
+    template <typename State, typename F, typename ... Args>
+    decltype(auto) with_arguments(F && f, Args && ... args) {
+        if constexpr (takes_arena<State, Args...>()) {
+            return f(context_arg(m_ctx), m_arena.region(), std::forward<Args>(args)...);
+        } else {
+            return f(context_arg(m_ctx), std::forward<Args>(args)...);
+        }
+    }
+
+    /*
+     * the callback states emit events through. cb(std::move(evt)) moves
+     * the event all the way into the next state, cb(evt) copies it once.
+     * cb.external(evt) is push(evt), for a state that keeps cb to call it
+     * later from outside any callback, as fsm_timer does: the event is
+     * traced as external, so a journal can replay it.
+     */
+    class emitter_type {
+    public:
+        explicit emitter_type(state_machine *machine) : m_machine(machine) {}
+
+        template <typename E>
+        void operator()(E && evt) const { m_machine->emit(std::forward<E>(evt)); }
+
+        template <typename E>
+        void external(E && evt) const { m_machine->push(std::forward<E>(evt)); }
+
+    private:
+        state_machine *m_machine;
+    };
+
+    emitter_type emitter() { return emitter_type(this); }
+
+    // an event from outside the machine, as opposed to one a state emits
+    template <typename E>
+    void push(E && evt) {
+        detail::trace_external(m_trace, std::as_const(evt));
+        emit(std::forward<E>(evt));
+    }
+
+    /*
+     * dispatches count external events from evts, in order, moving each
+     * out of the array, with the same result as pushing them one by one.
+     * the state is looked up once per run of events that leave it in place
+     * (accepted, refused by a guard or unmatched) instead of once per
+     * event, which is what a burst of protocol messages from one socket
+     * read mostly is.
+     */
+    void push_batch(events *evts, std::size_t count) {
+        if (m_running) {
+            // called from a callback: queue them behind what is pending
+            for (std::size_t i = 0; i < count; ++i) {
+                std::visit([this](auto & evt) {
+                    push(std::move(evt));
+                }, evts[i]);
+            }
+            return;
+        }
+
+        run_guard guard(m_running);
+        for (std::size_t i = 0; i < count;) {
+            i = run_batch(evts, i, count, std::make_index_sequence<std::variant_size_v<states>>());
+        }
+    }
+
+    /*
+     * events are moved, never copied, from here to the next state's
+     * operator(): dispatch() works on an event the machine owns (a local
+     * moved from the one passed in here, or its queue slot) and process()
+     * hands it over as an rvalue. move-only events such as
+     * std::unique_ptr<frame> work as well.
+     *
+     * the machine has to own it: cb(std::move(m_member)) passes a member of
+     * the emitting state, which process() destroys before the next state
+     * receives the event.
+     */
+    template <typename E>
+    void emit(E && evt) {
+        using Event = std::decay_t<E>;
+
+        if constexpr (queue_capacity > 0 && (contains_v<Event, events> || has_wildcard || accepts_unlisted)) {
+            if (m_running) {
+                bool queued;
+                if constexpr (contains_v<Event, events>) {
+                    queued = m_queue.push(std::forward<E>(evt));
+                } else {
+                    // only an any_event row or an accept() can take it, queued type-erased
+                    queued = m_queue.emplace(std::in_place_type<foreign_type>, std::forward<E>(evt), &dispatch_foreign<Event>);
+                }
+                if (queued) {
+                    m_arena.on_queued();
+                } else if (m_cb) {
+                    m_cb(std::make_error_code(std::errc::no_buffer_space));
                 }
+                return;
             }
+        }
 
-        }, m_state.value());
+        Event owned(std::forward<E>(evt));
+        if constexpr (queue_capacity == 0) {
+            dispatch(owned);
+        } else if (m_running) {
+            // a type no row takes and no template accept() could: consumed
+            // by a non-template accept() or reported unmatched right away
+            dispatch(owned);
+        } else {
+            run_guard guard(m_running);
+            dispatch(owned);
+            drain_queue();
+        }
     }
-//protected:
 
+    // flat run-to-completion loop: each queued event is dispatched only after
+    // the callback that emitted it has returned, so stack depth stays constant
+    void drain_queue() {
+        while (!m_queue.empty()) {
+            std::visit([this](auto & evt) {
+                if constexpr (std::is_same_v<std::decay_t<decltype(evt)>, foreign_type>) {
+                    evt.dispatch(*this);
+                } else {
+                    dispatch(evt);
+                }
+            }, m_queue.front());
+            m_queue.pop();
+            m_arena.on_dequeued();
+        }
+    }
+
+    template <typename Event>
+    static void dispatch_foreign(void *evt, state_machine &m) {
+        m.dispatch(*static_cast<Event *>(evt));
+    }
+
+    template <typename Event>
+    void dispatch(Event & evt) {
+        if constexpr (std::is_same_v<dispatch_type, visit_dispatch>) {
+            m_state.visit([&](auto & current_state) {
+                handle(current_state, evt);
+            });
+        } else {
+            dispatch_indexed(evt, std::make_index_sequence<std::variant_size_v<states>>());
+        }
+    }
 
+    template <typename Event, std::size_t ... Is>
+    void dispatch_indexed(Event & evt, std::index_sequence<Is...>) {
+        const std::size_t index = m_state.index();
+        if (index == std::variant_npos) {
+            // not started, or a state constructor threw during the last transition
+            throw std::bad_variant_access();
+        }
+
+        if constexpr (std::is_same_v<dispatch_type, table_dispatch>) {
+            using handler = void (state_machine::*)(Event &);
+            static constexpr handler handlers[] = { &state_machine::handle_indexed<Is, Event>... };
+            (this->*handlers[index])(evt);
+        } else {
+            static_assert(std::is_same_v<dispatch_type, switch_dispatch>, "unknown dispatch backend");
+            (void)((index == Is && (handle_indexed<Is, Event>(evt), true)) || ...);
+        }
+    }
+
+    template <std::size_t ... Is>
+    std::size_t run_batch(events *evts, std::size_t i, std::size_t count, std::index_sequence<Is...>) {
+        const std::size_t index = m_state.index();
+        if (index == std::variant_npos) {
+            throw std::bad_variant_access();
+        }
+        (void)((index == Is && (i = run_batch_in<Is>(evts, i, count), true)) || ...);
+        return i;
+    }
+
+    // events from i on while the machine stays in state I, returns where it left
+    template <std::size_t I>
+    std::size_t run_batch_in(events *evts, std::size_t i, std::size_t count) {
+        do {
+            auto &current_state = *m_state.template get_if<I>();
+            std::visit([&](auto & evt) {
+                detail::trace_external(m_trace, std::as_const(evt));
+                handle(current_state, evt);
+            }, evts[i]);
+            if constexpr (queue_capacity > 0) {
+                drain_queue();
+            }
+            ++i;
+        } while (i < count && m_state.index() == I);
+        return i;
+    }
+
+    template <std::size_t I, typename Event>
+    void handle_indexed(Event & evt) {
+        handle(*m_state.template get_if<I>(), evt);
+    }
+
+    template <typename State, typename Event>
+    void handle(State & current_state, Event & evt) {
+        if constexpr (detail::has_accept<State, Event, decltype(emitter())>::value) {
+            if (current_state.accept(evt, emitter())) {
+                return;
+            }
+        }
+
+        if constexpr(transition_index<State, Event> < transition_count) {
+            const bool taken = select_row<transition_index<State, Event>>(current_state, evt, [&](auto row) {
+                process<decltype(row)::value>(current_state, evt);
+            });
+            if (!taken) {
+                unmatched(current_state, evt);
+            }
+        } else {
+            unmatched(current_state, evt);
+        }
+    }
 
     template <typename State, typename Event>
-    auto constexpr /* __attribute__((deprecated))*/ process(const State & /*current_state*/, Event && evt)  {
+    void unmatched(State &, Event & evt) {
+        m_trace.template on_unmatched<State, Event>(evt);
+        if (m_cb) {
+            m_cb({});
+        }
+    }
+//protected:
+
+
+
+    // takes row Row, its guard already passed
+    template <std::size_t Row, typename State, typename Event>
+    auto constexpr /* __attribute__((deprecated))*/ process(State & current_state, Event && evt)  {
 
 
 
         using state_type            = typename std::decay<State>::type;
         using event_type            = typename std::decay<Event>::type;
 
-        static_assert(std::variant_size_v<TransitionTable> > match<TransitionTable, state_type, event_type>(), "no such transition");
+        static_assert(Row < transition_count, "no such transition");
 
 
-        using transition_state_t    = std::variant_alternative_t<match<TransitionTable, state_type, event_type>(), TransitionTable>; // transition_state_t is now a transition<x,y,z>
+        using transition_state_t    = std::variant_alternative_t<Row, transition_table>; // transition_state_t is now a transition<x,y,z>
         using next_state_t          = typename transition_state_t::next_state;
 
-        // instantiate next state, saving previous
-        auto prev = std::exchange(m_state, next_state_t(m_ctx));
+        typename transition_state_t::action()(current_state, evt);
+
+        // replace the current state in place. current_state refers into
+        // m_state, so it is gone once the next state has been emplaced
+        m_arena.on_transition();
 
+        next_state_t *next;
+        if constexpr (constructible<next_state_t, previous<state_type>>()) {
+            next_state_t tmp = with_arguments<next_state_t>([](auto && ... a) {
+                return next_state_t(std::forward<decltype(a)>(a)...);
+            }, previous<state_type>{current_state});
+            next = &m_state.template emplace<next_state_t>(std::move(tmp));
+        } else {
+            static_assert(constructible<next_state_t>(),
+                          "state must be constructible from context_arg without copying a by-reference context");
+            next = with_arguments<next_state_t>([this](auto && ... a) {
+                return &m_state.template emplace<next_state_t>(std::forward<decltype(a)>(a)...);
+            });
+        }
 
-        printf("[%s + %s > %s]\n", type_name<state_type>().c_str(), type_name<event_type>().c_str(), type_name<next_state_t>().c_str());
-        std::this_thread::sleep_for(std::chrono::seconds(1));
+
+        detail::trace_transition<state_type, event_type, next_state_t, Row>(m_trace, evt);
 
 
          // perform the transition / action
-        std::get<next_state_t>(*m_state)(evt, [&](auto && args) {
-            // this might be a good place to check for termination
-            push(args);
-        });
+        // this might be a good place to check for termination
+        (*next)(std::move(evt), emitter());
 
 
         //return std::get<next_state_t>(m_state); <- does not work, since m_state may have been changed mean-while!
     }
 
     Context m_ctx;
-    std::optional<states> m_state;
+    state_storage m_state;
     Callback m_cb;
+    trace_type m_trace;
+    event_queue<queued_events, queue_capacity> m_queue;
+    arena_type m_arena;
+    bool m_running = false;
+
+private:
+    struct run_guard {
+        run_guard(bool &flag) : m_flag(flag) { m_flag = true; }
+        ~run_guard() { m_flag = false; }
+        bool &m_flag;
+    };
 };
@@ -0,0 +1,174 @@
+#pragma once
+
+#include <array>
+#include <cstdio>
+#include <string_view>
+#include <utility>
+
+#include "fsm.hpp"
+
+/*
+ * table_analysis answers questions about a transition table at compile
+ * time, as constexpr values that can go into a static_assert:
+ *
+ *   reachable<Start>    per state, whether any path of rows leads to it
+ *                       from Start. guards are ignored, a guarded row
+ *                       counts as possibly taken
+ *   terminal            per state, true if no row leaves it
+ *   handles(s, e)       whether state s has a row for event e, exact or
+ *                       through any_event
+ *
+ *   using analysis = table_analysis<transitions>;
+ *   static_assert(analysis::all_reachable<start>, "dead states in the table");
+ *   static_assert(analysis::unhandled<start> == 0, "events without a row");
+ *
+ * print<Start>() lists the offenders by name when one of those fires.
+ *
+ * prune_table_t<Table, Start> drops the rows of states Start can never
+ * reach, and with them those states: they no longer take an alternative
+ * of the machine's states variant, a case in every dispatch switch or
+ * visit table, or the code of their instantiated operator().
+ */
+template <typename TransitionTable>
+struct table_analysis {
+    using transition_table = flatten_table_t<TransitionTable>;
+    using states = typename state_machine<TransitionTable>::states;
+    using events = typename state_machine<TransitionTable>::events;
+    using lookup = transition_lookup<transition_table, states, events>;
+
+    static constexpr std::size_t state_count      = size_of_v<states>;
+    static constexpr std::size_t event_count      = size_of_v<events>;
+    static constexpr std::size_t transition_count = lookup::transition_count;
+
+    using state_set = std::array<bool, state_count>;
+
+    template <typename Table>
+    struct next_states;
+
+    template <template <class...> class TT, typename ... Rows>
+    struct next_states<TT<Rows...>> {
+        static constexpr std::size_t value[] = { index_of_v<typename Rows::next_state, states>..., 0 };
+    };
+
+    // every state a path of rows leads to from start, start included
+    static constexpr state_set reachable_from(std::size_t start) {
+        state_set seen{};
+        seen[start] = true;
+        // a fixed point: each pass adds the states one row further out
+        for (bool grown = true; grown;) {
+            grown = false;
+            for (std::size_t i = 0; i < transition_count; ++i) {
+                const std::size_t next = next_states<transition_table>::value[i];
+                if (seen[lookup::entry[i]] && !seen[next]) {
+                    seen[next] = grown = true;
+                }
+            }
+        }
+        return seen;
+    }
+
+    template <typename Start>
+    static constexpr state_set reachable = reachable_from(index_of_v<Start, states>);
+
+    template <typename Start>
+    static constexpr bool all_reachable = [] {
+        for (bool r : reachable<Start>) {
+            if (!r) {
+                return false;
+            }
+        }
+        return true;
+    }();
+
+    static constexpr state_set terminal = [] {
+        state_set t{};
+        for (auto &s : t) {
+            s = true;
+        }
+        for (std::size_t i = 0; i < transition_count; ++i) {
+            t[lookup::entry[i]] = false;
+        }
+        return t;
+    }();
+
+    static constexpr bool handles(std::size_t s, std::size_t e) {
+        return lookup::table[s][e] < transition_count ||
+              (lookup::wildcard < event_count && lookup::table[s][lookup::wildcard] < transition_count);
+    }
+
+    // (state, event) pairs without a row, over the non-terminal states
+    // reachable from Start. any_event itself is not counted as an event
+    template <typename Start>
+    static constexpr std::size_t unhandled = [] {
+        std::size_t n = 0;
+        for (std::size_t s = 0; s < state_count; ++s) {
+            for (std::size_t e = 0; e < event_count; ++e) {
+                n += reachable<Start>[s] && !terminal[s] && e != lookup::wildcard && !handles(s, e);
+            }
+        }
+        return n;
+    }();
+
+    template <typename Start>
+    static void print(std::FILE *out = stdout) {
+        for (std::size_t s = 0; s < state_count; ++s) {
+            const std::string_view sn = state_names[s];
+            if (!reachable<Start>[s]) {
+                std::fprintf(out, "unreachable %.*s\n", int(sn.size()), sn.data());
+                continue;
+            }
+            if (terminal[s]) {
+                std::fprintf(out, "terminal %.*s\n", int(sn.size()), sn.data());
+                continue;
+            }
+            for (std::size_t e = 0; e < event_count; ++e) {
+                if (e != lookup::wildcard && !handles(s, e)) {
+                    const std::string_view en = event_names[e];
+                    std::fprintf(out, "unhandled %.*s + %.*s\n", int(sn.size()), sn.data(), int(en.size()), en.data());
+                }
+            }
+        }
+    }
+
+private:
+    template <std::size_t ... Is>
+    static constexpr std::array<std::string_view, state_count> names_of_states(std::index_sequence<Is...>) {
+        return {{ type_name<std::variant_alternative_t<Is, states>>()... }};
+    }
+
+    template <std::size_t ... Is>
+    static constexpr std::array<std::string_view, event_count> names_of_events(std::index_sequence<Is...>) {
+        return {{ type_name<std::variant_alternative_t<Is, events>>()... }};
+    }
+
+    static constexpr std::array<std::string_view, state_count> state_names = names_of_states(std::make_index_sequence<state_count>());
+    static constexpr std::array<std::string_view, event_count> event_names = names_of_events(std::make_index_sequence<event_count>());
+};
+
+
+namespace detail {
+    template <typename Analysis, typename Start, typename Table, typename Is>
+    struct prune_rows;
+
+    template <typename Analysis, typename Start, template <class...> class TT, typename ... Rows, std::size_t ... Is>
+    struct prune_rows<Analysis, Start, TT<Rows...>, std::index_sequence<Is...>> {
+        using type = typename rebind_list<TT, concat_t<
+            std::conditional_t<Analysis::template reachable<Start>[Analysis::lookup::entry[Is]],
+                               type_list<Rows>, type_list<>>...>>::type;
+    };
+}
+
+// the flattened rows of TransitionTable whose entry state Start can reach
+template <typename TransitionTable, typename Start>
+struct prune_table {
+    using analysis = table_analysis<TransitionTable>;
+    using flat     = typename analysis::transition_table;
+
+    static_assert(contains_v<Start, typename analysis::states>, "start state is not in the transition table");
+
+    using type = typename detail::prune_rows<analysis, Start, flat,
+                                             std::make_index_sequence<size_of_v<flat>>>::type;
+};
+
+template <typename TransitionTable, typename Start>
+using prune_table_t = typename prune_table<TransitionTable, Start>::type;
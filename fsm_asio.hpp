@@ -0,0 +1,99 @@
+#pragma once
+
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <variant>
+
+#include <asio.hpp>
+
+#include "fsm.hpp"
+
+/*
+ * asio_context is what the states of an asio_machine share: the user's
+ * Context plus the machine's strand. states that start asynchronous work
+ * keep the callback they were given and hand it to wrap(), which returns a
+ * completion token that may run on any io_context thread: invoking it with
+ * an event dispatches the transition on the strand, so the machine itself
+ * is never entered concurrently and nothing blocks.
+ *
+ *   template <typename Callable>
+ *   void operator()(success<sock>, Callable && cb) {
+ *       m_socket.async_connect(m_endpoint, m_ctx->wrap([cb](asio::error_code ec) mutable {
+ *           if (ec) cb(error_event(ec, "connect")); else cb(success<sock>(0));
+ *       }));
+ *   }
+ *
+ * the callback stays valid for as long as the machine does, so the machine
+ * must outlive every operation its states started.
+ */
+template <typename Context = std::monostate>
+class asio_context : public Context {
+public:
+    using executor_type = asio::strand<asio::io_context::executor_type>;
+
+    template <typename ... Args>
+    explicit asio_context(asio::io_context &io, Args && ... args) :
+        Context(std::forward<Args>(args)...),
+        m_strand(io.get_executor())
+    {}
+
+    executor_type get_executor() const { return m_strand; }
+
+    // f runs on the strand, whichever thread completes the operation
+    template <typename Handler>
+    auto wrap(Handler && f) const {
+        return asio::bind_executor(m_strand, std::forward<Handler>(f));
+    }
+
+private:
+    executor_type m_strand;
+};
+
+/*
+ * asio_machine is a state_machine whose transitions all run on its own
+ * strand of a shared io_context. thousands of connection machines can live
+ * on one io_context run by any number of threads: post() and start() may
+ * be called from anywhere and are queued onto the strand, events a state
+ * emits synchronously from its operator() still go through the usual
+ * run-to-completion path.
+ */
+template <typename TransitionTable, typename Context = std::monostate, typename Policy = default_policy>
+class asio_machine : public state_machine<TransitionTable, asio_context<Context>, Policy> {
+    using base = state_machine<TransitionTable, asio_context<Context>, Policy>;
+
+public:
+    using events        = typename base::events;
+    using executor_type = typename asio_context<Context>::executor_type;
+
+    // the remaining arguments construct the user's Context
+    template <typename ... Args>
+    explicit asio_machine(asio::io_context &io, Args && ... args) :
+        base(std::in_place, io, std::forward<Args>(args)...)
+    {}
+
+    asio_machine(const asio_machine &) = delete;
+    asio_machine &operator=(const asio_machine &) = delete;
+
+    executor_type get_executor() const { return this->m_ctx.get_executor(); }
+
+    // any thread. args are copied until StartState is entered on the strand
+    template <typename StartState, typename ... Args>
+    void start(Args && ... args) {
+        asio::dispatch(get_executor(), [this, params = std::make_tuple(std::decay_t<Args>(std::forward<Args>(args))...)]() mutable {
+            std::apply([this](auto & ... a) {
+                base::template start<StartState>(std::move(a)...);
+            }, params);
+        });
+    }
+
+    // any thread
+    template <typename Event>
+    void post(Event && evt) {
+        using event_type = std::decay_t<Event>;
+        static_assert(contains_v<event_type, events>, "only events listed in the transition table can be posted");
+        asio::post(get_executor(), [this, e = event_type(std::forward<Event>(evt))]() mutable {
+            this->push(std::move(e));
+        });
+    }
+};
@@ -0,0 +1,364 @@
+#pragma once
+
+#if !defined(__cpp_impl_coroutine) || !__has_include(<coroutine>)
+#error "fsm_coro.hpp needs C++20 coroutines (-std=c++20)"
+#endif
+
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <new>
+#include <optional>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <variant>
+
+#include "fsm.hpp"
+
+/*
+ * coroutine states. instead of a callback-taking operator() a state writes
+ * one body that waits for events and returns the event it emits:
+ *
+ *   struct handshake : coro_state<handshake, std::variant<success<sock>, error_event>> {
+ *       handshake(context_ref<coro_context<context>> ctx) : coro_state(ctx->arena()) {}
+ *
+ *       task run(success<sock> s) {
+ *           auto hello = co_await next_event<success<std::string>>();
+ *           if (hello.value != "hello")
+ *               co_return error_event(std::errc::protocol_error, "bad greeting");
+ *           co_return s;
+ *       }
+ *   };
+ *
+ * the machine enters the state as usual, the body runs until it first
+ * suspends. while it waits, the events it named are handed to it through
+ * the accept() hook instead of causing a transition, every other event
+ * still goes through the table (which destroys the state and its frame).
+ * co_return emits the result exactly as cb(result) would.
+ *
+ * frames come from the machine's coro_arena, not the heap. at most one
+ * state is alive per machine, so frames are freed in LIFO order and the
+ * arena is just a bump pointer that falls back to operator new only when a
+ * frame does not fit.
+ */
+
+
+/*
+ * per-machine frame storage: Size bytes inside coro_context, handed out and
+ * returned stack-wise. copying a context gives the copy its own empty arena.
+ */
+class coro_arena_base {
+public:
+    coro_arena_base(const coro_arena_base &) = delete;
+    coro_arena_base &operator=(const coro_arena_base &) = delete;
+
+    void *allocate(std::size_t n) {
+        n = (n + align - 1) & ~(align - 1);
+        if (m_size - m_top >= n) {
+            void *p = m_buf + m_top;
+            m_top += n;
+            return p;
+        }
+        ++m_overflows;
+        return ::operator new(n);
+    }
+
+    void deallocate(void *p) {
+        unsigned char *b = static_cast<unsigned char *>(p);
+        if (b >= m_buf && b < m_buf + m_size) {
+            m_top = static_cast<std::size_t>(b - m_buf);
+        } else {
+            ::operator delete(p);
+        }
+    }
+
+    std::size_t capacity() const { return m_size; }
+    std::size_t used() const { return m_top; }
+
+    // frames that did not fit and went to the heap instead
+    std::size_t overflows() const { return m_overflows; }
+
+protected:
+    static constexpr std::size_t align = alignof(std::max_align_t);
+
+    coro_arena_base(unsigned char *buf, std::size_t size) : m_buf(buf), m_size(size) {}
+
+private:
+    unsigned char *m_buf;
+    std::size_t m_size;
+    std::size_t m_top = 0;
+    std::size_t m_overflows = 0;
+};
+
+template <std::size_t Size = 1024>
+class coro_arena : public coro_arena_base {
+public:
+    coro_arena() : coro_arena_base(m_storage, Size) {}
+    coro_arena(const coro_arena &) : coro_arena() {}
+    coro_arena &operator=(const coro_arena &) { return *this; }
+
+private:
+    alignas(std::max_align_t) unsigned char m_storage[Size];
+};
+
+
+// the user's Context plus the machine's frame arena
+template <typename Context = std::monostate, std::size_t ArenaSize = 1024>
+class coro_context : public Context {
+public:
+    template <typename ... Args>
+    explicit coro_context(Args && ... args) :
+        Context(std::forward<Args>(args)...)
+    {}
+
+    coro_arena_base &arena() { return m_arena; }
+
+private:
+    coro_arena<ArenaSize> m_arena;
+};
+
+
+namespace detail {
+    // a per-type address, so events can be matched without rtti
+    template <typename T>
+    struct event_tag {
+        static constexpr char id = 0;
+    };
+
+    template <typename T>
+    constexpr const void *event_id() { return &event_tag<T>::id; }
+
+    // the suspended co_await next_event<...>(), if any
+    struct event_awaiter_base {
+        bool (*deliver)(event_awaiter_base &self, const void *id, void *evt);
+    };
+
+    // set by coro_state just around the call to run()
+    inline thread_local coro_arena_base *frame_arena = nullptr;
+
+    struct task_promise_base {
+        // the frame of a run() comes from its state's arena, any other
+        // coroutine returning fsm_task gets a heap frame. the arena is
+        // remembered in front of the frame for operator delete
+        static void *operator new(std::size_t n) {
+            coro_arena_base *arena = std::exchange(frame_arena, nullptr);
+            void *p = arena ? arena->allocate(n + header) : ::operator new(n + header);
+            *static_cast<coro_arena_base **>(p) = arena;
+            return static_cast<unsigned char *>(p) + header;
+        }
+
+        static void operator delete(void *frame) {
+            void *p = static_cast<unsigned char *>(frame) - header;
+            if (coro_arena_base *arena = *static_cast<coro_arena_base **>(p)) {
+                arena->deallocate(p);
+            } else {
+                ::operator delete(p);
+            }
+        }
+
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        void unhandled_exception() { m_error = std::current_exception(); }
+
+        event_awaiter_base *m_waiting = nullptr;
+        std::exception_ptr m_error;
+
+    private:
+        static constexpr std::size_t header = alignof(std::max_align_t);
+    };
+
+    template <typename Result>
+    struct task_promise : task_promise_base {
+        template <typename T>
+        void return_value(T && value) { m_result.emplace(std::forward<T>(value)); }
+
+        std::optional<Result> m_result;
+    };
+
+    template <>
+    struct task_promise<void> : task_promise_base {
+        void return_void() {}
+    };
+}
+
+
+/*
+ * the return type of a coroutine state's run(). owns the frame; Result is
+ * what co_return emits, a std::variant to emit one of several events.
+ */
+template <typename Result = void>
+class fsm_task {
+public:
+    struct promise_type : detail::task_promise<Result> {
+        fsm_task get_return_object() { return fsm_task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+    };
+
+    fsm_task() = default;
+    fsm_task(fsm_task && other) noexcept : m_handle(std::exchange(other.m_handle, {})) {}
+
+    fsm_task &operator=(fsm_task && other) noexcept {
+        if (this != &other) {
+            reset();
+            m_handle = std::exchange(other.m_handle, {});
+        }
+        return *this;
+    }
+
+    ~fsm_task() { reset(); }
+
+    bool done() const { return !m_handle || m_handle.done(); }
+
+    // hands evt to the body if it waits for this type and resumes it
+    template <typename Event>
+    bool deliver(Event & evt) {
+        if (done() || !m_handle.promise().m_waiting) {
+            return false;
+        }
+        detail::event_awaiter_base &w = *m_handle.promise().m_waiting;
+        if (!w.deliver(w, detail::event_id<Event>(), &evt)) {
+            return false;
+        }
+        m_handle.promise().m_waiting = nullptr;
+        m_handle.resume();
+        return true;
+    }
+
+    // once done: rethrows what the body threw, else returns what it co_returned
+    Result take() {
+        if (m_handle.promise().m_error) {
+            std::rethrow_exception(m_handle.promise().m_error);
+        }
+        if constexpr (!std::is_void_v<Result>) {
+            return std::move(*m_handle.promise().m_result);
+        }
+    }
+
+    void reset() {
+        if (m_handle) {
+            m_handle.destroy();
+            m_handle = {};
+        }
+    }
+
+private:
+    explicit fsm_task(std::coroutine_handle<promise_type> h) : m_handle(h) {}
+
+    std::coroutine_handle<promise_type> m_handle;
+};
+
+
+/*
+ * co_await next_event<A>() suspends until the machine delivers an A and
+ * yields it; next_event<A, B>() yields a std::variant<A, B>.
+ */
+template <typename ... Events>
+class next_event : detail::event_awaiter_base {
+public:
+    using value_type = typename std::conditional_t<sizeof...(Events) == 1,
+                                                   std::tuple_element<0, std::tuple<Events...>>,
+                                                   std::common_type<std::variant<Events...>>>::type;
+
+    next_event() : detail::event_awaiter_base{&next_event::deliver_to} {}
+
+    bool await_ready() const noexcept { return false; }
+
+    template <typename Promise>
+    void await_suspend(std::coroutine_handle<Promise> h) noexcept {
+        h.promise().m_waiting = this;
+    }
+
+    value_type await_resume() { return std::move(*m_value); }
+
+private:
+    template <typename Event>
+    bool store(const void *id, void *evt) {
+        if (id != detail::event_id<Event>()) {
+            return false;
+        }
+        if constexpr (sizeof...(Events) == 1) {
+            m_value.emplace(std::move(*static_cast<Event *>(evt)));
+        } else {
+            m_value.emplace(std::in_place_type<Event>, std::move(*static_cast<Event *>(evt)));
+        }
+        return true;
+    }
+
+    static bool deliver_to(detail::event_awaiter_base &self, const void *id, void *evt) {
+        next_event &me = static_cast<next_event &>(self);
+        return (me.template store<Events>(id, evt) || ...);
+    }
+
+    std::optional<value_type> m_value;
+};
+
+
+/*
+ * base of a coroutine state. Derived provides run() for the start state and
+ * run(Event) for every event it is entered through, all returning task.
+ */
+template <typename Derived, typename Result = void>
+class coro_state {
+public:
+    using task = fsm_task<Result>;
+
+    explicit coro_state(coro_arena_base &arena) : m_arena(&arena) {}
+
+    template <typename Callable>
+    void operator()(Callable && cb) {
+        detail::frame_arena = m_arena;
+        m_task = derived().run();
+        finish(cb);
+    }
+
+    template <typename Event, typename Callable>
+    void operator()(Event && evt, Callable && cb) {
+        detail::frame_arena = m_arena;
+        m_task = derived().run(std::forward<Event>(evt));
+        finish(cb);
+    }
+
+    template <typename Event, typename Callable>
+    bool accept(Event & evt, Callable && cb) {
+        if (!m_task.deliver(evt)) {
+            return false;
+        }
+        finish(cb);
+        return true;
+    }
+
+private:
+    Derived &derived() { return static_cast<Derived &>(*this); }
+
+    // emits the result of a finished body. the frame is released first and
+    // nothing of this state is touched after cb, which may replace it
+    template <typename Callable>
+    void finish(Callable & cb) {
+        if (!m_task.done()) {
+            return;
+        }
+        if constexpr (std::is_void_v<Result>) {
+            m_task.take();
+            m_task.reset();
+        } else {
+            Result result = m_task.take();
+            m_task.reset();
+            if constexpr (is_variant<Result>::value) {
+                std::visit([&](auto & evt) {
+                    cb(std::move(evt));
+                }, result);
+            } else {
+                cb(std::move(result));
+            }
+        }
+    }
+
+    template <typename T>
+    struct is_variant : std::false_type {};
+
+    template <typename ... Ts>
+    struct is_variant<std::variant<Ts...>> : std::true_type {};
+
+    coro_arena_base *m_arena;
+    task m_task;
+};
@@ -0,0 +1,319 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+#if defined(__SSSE3__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#include "fsm.hpp"
+
+/*
+ * index-only machines, for tables whose states carry no data: a packet
+ * classifier's states are names, only which one a machine is in matters.
+ * the same transition<> table is lowered at compile time to a dense
+ * [state][event] matrix of next state indices, narrowed like machine_pool's
+ * index, and a machine is nothing but its current index:
+ *
+ *   dfa_machine<classifier> m;
+ *   m.start<header>();
+ *   m.push(byte_class<3>{});            // one load from the matrix
+ *
+ * states are never constructed and no operator() runs; rows may not have
+ * guards or actions. a state without a row for an event stays where it is,
+ * an any_event row covers the events a state has no exact row for.
+ *
+ * dfa_pool runs thousands of such machines out of one index array. a
+ * broadcast of one event is a lookup in one column of the matrix, which
+ * with SSSE3 (or AVX2) is a byte shuffle of 16 (or 32) machines at a time
+ * for tables of up to 64 states; step() gives every machine its own event,
+ * gathered 8 machines at a time with AVX2. both fall back to a plain loop
+ * on other targets, so build with e.g. -march=native to get them.
+ */
+namespace detail {
+    template <typename Table>
+    struct plain_rows;
+
+    template <template <class...> class TT, typename ... Rows>
+    struct plain_rows<TT<Rows...>> : std::bool_constant<(... && (std::is_same_v<typename Rows::guard, always> &&
+                                                                  std::is_same_v<typename Rows::action, no_action>))> {};
+
+    template <typename Lookup, typename Table, typename States>
+    struct dfa_cells;
+
+    template <typename Lookup, template <class...> class TT, typename ... Rows, typename States>
+    struct dfa_cells<Lookup, TT<Rows...>, States> {
+        static constexpr std::size_t next_state[] = { index_of_v<typename Rows::next_state, States>..., 0 };
+
+        // next state of s on e, s itself if there is no row
+        static constexpr std::size_t next_of(std::size_t s, std::size_t e) {
+            std::size_t row = Lookup::table[s][e];
+            if (row == Lookup::transition_count && Lookup::wildcard < Lookup::event_count) {
+                row = Lookup::table[s][Lookup::wildcard];
+            }
+            return row < Lookup::transition_count ? next_state[row] : s;
+        }
+    };
+}
+
+template <typename TransitionTable>
+struct dfa_table {
+    using transition_table = flatten_table_t<TransitionTable>;
+    using states = remove_duplicates_t<typename extract_lists<transition_table>::states>;
+    using events = remove_duplicates_t<typename extract_lists<transition_table>::events>;
+    using lookup = transition_lookup<transition_table, states, events>;
+
+    using cells  = detail::dfa_cells<lookup, transition_table, states>;
+
+    static_assert(detail::plain_rows<transition_table>::value, "index-only machines cannot run guards or actions");
+
+    static constexpr std::size_t state_count = size_of_v<states>;
+    static constexpr std::size_t event_count = size_of_v<events>;
+
+    using index_type = smallest_unsigned_t<state_count - 1>;
+    using event_type = smallest_unsigned_t<event_count - 1>;
+
+    template <typename State>
+    static constexpr index_type state_index = [] {
+        static_assert(contains_v<State, states>, "state is not in the transition table");
+        return index_type(index_of_v<State, states>);
+    }();
+
+    // the column an event is looked up in: its own, else the any_event one
+    template <typename Event>
+    static constexpr event_type event_index = [] {
+        if constexpr (contains_v<Event, events>) {
+            return event_type(index_of_v<Event, events>);
+        } else {
+            static_assert(sizeof(Event) > 0 && lookup::wildcard < event_count,
+                          "event is not in the transition table, which has no any_event row");
+            return event_type(lookup::wildcard);
+        }
+    }();
+
+    // next[s * event_count + e]
+    static constexpr std::array<index_type, state_count * event_count> next = [] {
+        std::array<index_type, state_count * event_count> m{};
+        for (std::size_t s = 0; s < state_count; ++s) {
+            for (std::size_t e = 0; e < event_count; ++e) {
+                m[s * event_count + e] = index_type(cells::next_of(s, e));
+            }
+        }
+        return m;
+    }();
+
+    // the same matrix in 32 bit cells, for gathers
+    static constexpr std::array<std::uint32_t, state_count * event_count> next_wide = [] {
+        std::array<std::uint32_t, state_count * event_count> m{};
+        for (std::size_t i = 0; i < m.size(); ++i) {
+            m[i] = next[i];
+        }
+        return m;
+    }();
+
+    // column e of the matrix, padded to whole 16 byte shuffle tables
+    static constexpr std::size_t column_size = (state_count + 15) / 16 * 16;
+
+    static constexpr std::array<std::array<index_type, column_size>, event_count> by_event = [] {
+        std::array<std::array<index_type, column_size>, event_count> c{};
+        for (std::size_t e = 0; e < event_count; ++e) {
+            for (std::size_t s = 0; s < state_count; ++s) {
+                c[e][s] = index_type(cells::next_of(s, e));
+            }
+        }
+        return c;
+    }();
+};
+
+
+// one machine: its state index, advanced by a single matrix lookup per event
+template <typename TransitionTable>
+class dfa_machine {
+public:
+    using table      = dfa_table<TransitionTable>;
+    using states     = typename table::states;
+    using events     = typename table::events;
+    using index_type = typename table::index_type;
+    using event_type = typename table::event_type;
+
+    // in the table's first state until started
+    template <typename StartState>
+    void start() { m_state = table::template state_index<StartState>; }
+
+    template <typename Event>
+    void push(const Event &) { push_index(table::template event_index<Event>); }
+
+    void push_index(event_type e) { m_state = table::next[std::size_t(m_state) * table::event_count + e]; }
+
+    index_type state_index() const { return m_state; }
+
+    template <typename State>
+    bool is() const { return m_state == table::template state_index<State>; }
+
+private:
+    index_type m_state = 0;
+};
+
+
+namespace detail {
+    // column[states[i]] for a prefix of states, a 16 entry byte shuffle per
+    // Tables; returns how many machines it advanced
+    template <std::size_t Tables>
+    std::size_t dfa_shuffle(std::uint8_t *states, std::size_t count, const std::uint8_t *column) {
+        static_assert(Tables >= 1 && Tables <= 4, "byte shuffles cover up to 64 states");
+        std::size_t i = 0;
+    #if defined(__AVX2__)
+        __m256i tables[Tables];
+        for (std::size_t t = 0; t < Tables; ++t) {
+            tables[t] = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i *>(column + 16 * t)));
+        }
+        const __m256i nibble = _mm256_set1_epi8(0x0f);
+        for (; i + 32 <= count; i += 32) {
+            const __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(states + i));
+            __m256i next;
+            if constexpr (Tables == 1) {
+                next = _mm256_shuffle_epi8(tables[0], s);
+            } else {
+                const __m256i low  = _mm256_and_si256(s, nibble);
+                const __m256i high = _mm256_and_si256(_mm256_srli_epi16(s, 4), nibble);
+                next = _mm256_setzero_si256();
+                for (std::size_t t = 0; t < Tables; ++t) {
+                    const __m256i in_table = _mm256_cmpeq_epi8(high, _mm256_set1_epi8(char(t)));
+                    next = _mm256_or_si256(next, _mm256_and_si256(in_table, _mm256_shuffle_epi8(tables[t], low)));
+                }
+            }
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(states + i), next);
+        }
+    #elif defined(__SSSE3__)
+        __m128i tables[Tables];
+        for (std::size_t t = 0; t < Tables; ++t) {
+            tables[t] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(column + 16 * t));
+        }
+        const __m128i nibble = _mm_set1_epi8(0x0f);
+        for (; i + 16 <= count; i += 16) {
+            const __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i *>(states + i));
+            __m128i next;
+            if constexpr (Tables == 1) {
+                next = _mm_shuffle_epi8(tables[0], s);
+            } else {
+                const __m128i low  = _mm_and_si128(s, nibble);
+                const __m128i high = _mm_and_si128(_mm_srli_epi16(s, 4), nibble);
+                next = _mm_setzero_si128();
+                for (std::size_t t = 0; t < Tables; ++t) {
+                    const __m128i in_table = _mm_cmpeq_epi8(high, _mm_set1_epi8(char(t)));
+                    next = _mm_or_si128(next, _mm_and_si128(in_table, _mm_shuffle_epi8(tables[t], low)));
+                }
+            }
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(states + i), next);
+        }
+    #else
+        (void)states;
+        (void)count;
+        (void)column;
+    #endif
+        return i;
+    }
+
+    // next[states[i] * Events + events[i]] for a prefix of 8 bit states and
+    // events, 8 gathers at a time; returns how many machines it advanced
+    template <std::size_t Events, typename Index, typename Event>
+    std::size_t dfa_gather(Index *states, const Event *events, std::size_t count, const std::uint32_t *next) {
+        std::size_t i = 0;
+    #if defined(__AVX2__)
+        if constexpr (sizeof(Index) == 1 && sizeof(Event) == 1) {
+            const __m256i stride = _mm256_set1_epi32(int(Events));
+            for (; i + 8 <= count; i += 8) {
+                const __m256i s = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(states + i)));
+                const __m256i e = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(events + i)));
+                const __m256i cell = _mm256_add_epi32(_mm256_mullo_epi32(s, stride), e);
+                const __m256i n = _mm256_i32gather_epi32(reinterpret_cast<const int *>(next), cell, 4);
+
+                // 8 x 32 bit lanes back to 8 bytes
+                const __m256i words = _mm256_packus_epi32(n, n);
+                const __m128i packed = _mm_unpacklo_epi64(_mm256_castsi256_si128(words), _mm256_extracti128_si256(words, 1));
+                _mm_storel_epi64(reinterpret_cast<__m128i *>(states + i), _mm_packus_epi16(packed, packed));
+            }
+        }
+    #else
+        (void)states;
+        (void)events;
+        (void)count;
+        (void)next;
+    #endif
+        return i;
+    }
+}
+
+/*
+ * many index-only machines of one table in a single array of state
+ * indices. machines are ids into it, as in machine_pool, and all start in
+ * the table's first state.
+ */
+template <typename TransitionTable>
+class dfa_pool {
+public:
+    using table      = dfa_table<TransitionTable>;
+    using states     = typename table::states;
+    using events     = typename table::events;
+    using index_type = typename table::index_type;
+    using event_type = typename table::event_type;
+
+    explicit dfa_pool(std::size_t count) : m_state(count, 0) {}
+
+    std::size_t size() const { return m_state.size(); }
+
+    template <typename StartState>
+    void start(std::size_t id) { m_state[id] = table::template state_index<StartState>; }
+
+    template <typename StartState>
+    void start_all() {
+        for (index_type &s : m_state) {
+            s = table::template state_index<StartState>;
+        }
+    }
+
+    index_type state_index(std::size_t id) const { return m_state[id]; }
+
+    template <typename State>
+    bool is(std::size_t id) const { return m_state[id] == table::template state_index<State>; }
+
+    template <typename Event>
+    void push(std::size_t id, const Event &) {
+        m_state[id] = table::next[std::size_t(m_state[id]) * table::event_count + table::template event_index<Event>];
+    }
+
+    // the same event to every machine
+    template <typename Event>
+    void broadcast(const Event &) { broadcast_index(table::template event_index<Event>); }
+
+    void broadcast_index(event_type e) {
+        const index_type *column = table::by_event[e].data();
+        index_type *s = m_state.data();
+        const std::size_t n = m_state.size();
+        std::size_t i = 0;
+        if constexpr (sizeof(index_type) == 1 && table::state_count <= 64) {
+            i = detail::dfa_shuffle<table::column_size / 16>(s, n, column);
+        }
+        for (; i < n; ++i) {
+            s[i] = column[s[i]];
+        }
+    }
+
+    // machine i takes event index events[i], e.g. table::event_index<E> per
+    // classified byte; size() of them
+    void step(const event_type *events) {
+        index_type *s = m_state.data();
+        const std::size_t n = m_state.size();
+        std::size_t i = detail::dfa_gather<table::event_count>(s, events, n, table::next_wide.data());
+        for (; i < n; ++i) {
+            s[i] = table::next[std::size_t(s[i]) * table::event_count + events[i]];
+        }
+    }
+
+private:
+    std::vector<index_type> m_state;
+};
@@ -0,0 +1,504 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "fsm.hpp"
+#include "mpsc_queue.hpp"
+
+struct executor_options {
+    std::size_t threads        = std::max(1u, std::thread::hardware_concurrency());
+    std::size_t max_machines   = 1 << 16;
+    std::size_t inbox_capacity = 1 << 12;   // per shard, power of two
+    std::size_t steal_depth    = 64;        // victim queue depth before an idle shard steals
+    bool        work_stealing  = false;     // only if states may run on any thread
+    bool        pin_threads    = false;     // pin worker i to cpu i (linux only)
+
+    // called on the worker thread when a state or action throws while
+    // starting a machine or taking a posted event; none drops the exception
+    std::function<void(std::uint32_t id, std::exception_ptr error)> on_error;
+};
+
+/*
+ * sharded_executor owns N worker threads. every machine belongs to exactly
+ * one shard at a time and only that shard's thread ever touches it; other
+ * threads post events by machine id and they are routed to the owner's
+ * lock-free inbox. nothing on the event path is shared between shards
+ * except the per-machine routing slot.
+ *
+ * with work_stealing an idle shard asks the busiest one for machines. only
+ * quiescent machines move (no event of theirs in flight), so events for a
+ * machine are still executed in the order they were posted. machines must
+ * then not depend on running on a particular thread.
+ *
+ * destroy() ends a session: posts fail from then on, the events posted
+ * before it still run, then the owner deletes the machine and its id goes
+ * back to spawn(). a post racing with the destroy of its machine either
+ * runs on that machine or fails, it never reaches a later one on the id.
+ *
+ * an exception from a machine does not end its worker: it goes to
+ * executor_options::on_error and the shard carries on with the next
+ * command. the machine stays where the throw left it.
+ */
+template <typename TransitionTable, typename Context = bool, typename Policy = default_policy>
+class sharded_executor {
+public:
+    using machine_id = std::uint32_t;
+
+    // the per-session machine, push() exposed for the shard loop
+    class machine : public state_machine<TransitionTable, Context, Policy> {
+        using base = state_machine<TransitionTable, Context, Policy>;
+    public:
+        using base::base;
+        using base::push;
+    };
+
+    using events = typename machine::events;
+
+    explicit sharded_executor(executor_options opts = executor_options()) :
+        m_opts(opts),
+        m_slots(new slot[opts.max_machines]),
+        m_machines(opts.max_machines)
+    {
+        if (m_opts.threads == 0) {
+            throw std::invalid_argument("sharded_executor needs at least one thread");
+        }
+        for (std::size_t i = 0; i < m_opts.threads; ++i) {
+            m_shards.emplace_back(new shard(m_opts.inbox_capacity));
+        }
+        for (std::size_t i = 0; i < m_opts.threads; ++i) {
+            m_shards[i]->worker = std::thread([this, i] { run(i); });
+        }
+    }
+
+    sharded_executor(const sharded_executor &) = delete;
+    sharded_executor &operator=(const sharded_executor &) = delete;
+
+    ~sharded_executor() { stop(); }
+
+    // executes what is already posted, then joins the workers
+    void stop() {
+        m_stop.store(true);
+        for (auto &s : m_shards) {
+            if (s->worker.joinable()) {
+                s->worker.join();
+            }
+        }
+    }
+
+    /*
+     * creates a machine with its own context on the next shard (round
+     * robin) and enters StartState there. Args are copied into the start
+     * command, so this is meant for session setup, not the hot path.
+     */
+    template <typename StartState, typename ... Args>
+    machine_id spawn(Context ctx, Args && ... args) {
+        const machine_id id = allocate_id();
+        const std::uint32_t owner = static_cast<std::uint32_t>(m_next_shard.fetch_add(1) % m_shards.size());
+
+        m_machines[id].reset(new machine(std::move(ctx)));
+        m_slots[id].inflight.fetch_add(1);
+        m_slots[id].owner.store(owner);
+
+        start_cmd cmd{id, [params = std::make_tuple(std::decay_t<Args>(std::forward<Args>(args))...)](machine &m) mutable {
+            std::apply([&](auto & ... a) {
+                m.template start<StartState>(std::move(a)...);
+            }, params);
+        }};
+        while (!m_shards[owner]->inbox.emplace(std::move(cmd))) {
+            std::this_thread::yield();
+        }
+        // posts fail until here, so none lands ahead of the start
+        m_slots[id].alive.store(true);
+        return id;
+    }
+
+    // any thread. false if the machine is destroyed or the owning shard's
+    // inbox is full; std::out_of_range for an id spawn() never returned
+    template <typename Event>
+    bool post(machine_id id, Event && evt) {
+        using event_type = std::decay_t<Event>;
+        static_assert(contains_v<event_type, events>, "only events listed in the transition table can be posted");
+
+        return route(id, true, [&] {
+            return deliver{id, events(std::in_place_type<event_type>, std::forward<Event>(evt))};
+        });
+    }
+
+    /*
+     * any thread. the machine is deleted on its shard after the events
+     * already posted to it, and its id is reused by a later spawn(). false
+     * if it was destroyed already, or the inbox is full.
+     */
+    bool destroy(machine_id id) {
+        check(id);
+        if (!m_slots[id].alive.exchange(false)) {
+            return false;
+        }
+        m_retiring.fetch_add(1);
+        if (!route(id, false, [&] { return retire{id}; })) {
+            m_retiring.fetch_sub(1);
+            m_slots[id].alive.store(true);
+            return false;
+        }
+        return true;
+    }
+
+    std::size_t shard_count() const { return m_shards.size(); }
+
+    /*
+     * approximate number of posted events a shard has not executed yet.
+     * this also drives stealing, so bookkeeping commands such as the
+     * machines handed over by a steal are deliberately not counted.
+     */
+    std::size_t queue_depth(std::size_t shard) const { return m_shards[shard]->backlog.load(std::memory_order_relaxed); }
+
+    // approximate number of machines a shard currently owns
+    std::size_t machine_count(std::size_t shard) const { return m_shards[shard]->machines.load(std::memory_order_relaxed); }
+
+    std::size_t shard_of(machine_id id) const { return m_slots[id].owner.load(); }
+
+private:
+    static constexpr std::uint32_t no_owner  = UINT32_MAX;
+    static constexpr std::uint32_t migrating = UINT32_MAX - 1;
+
+    // routing for one machine, written by producers and the owning shard.
+    // epoch counts the machines the id has had
+    struct slot {
+        std::atomic<std::uint32_t> owner{no_owner};
+        std::atomic<std::uint32_t> inflight{0};
+        std::atomic<std::uint32_t> epoch{0};
+        std::atomic<bool> alive{false};
+    };
+
+    struct deliver {
+        machine_id id;
+        events evt;
+    };
+
+    struct start_cmd {
+        machine_id id;
+        std::function<void(machine &)> start;
+    };
+
+    struct adopt {
+        machine_id id;
+    };
+
+    struct retire {
+        machine_id id;
+    };
+
+    struct steal {
+        std::uint32_t thief;
+    };
+
+    using command = std::variant<deliver, start_cmd, adopt, steal, retire>;
+
+    struct shard {
+        explicit shard(std::size_t capacity) : inbox(capacity) {}
+
+        mpsc_queue<command> inbox;
+        std::thread worker;
+        std::vector<machine_id> owned;          // worker thread only
+        std::vector<machine_id> retiring;       // worker thread only, destroyed with events still in flight
+        std::atomic<std::size_t> machines{0};
+        std::atomic<bool> steal_pending{false};
+
+        // written by every producer, kept off the consumer's lines
+        alignas(64) std::atomic<std::size_t> backlog{0};
+    };
+
+    void check(machine_id id) const {
+        if (id >= m_opts.max_machines) {
+            throw std::out_of_range("sharded_executor: no such machine id");
+        }
+    }
+
+    // a free id from destroyed machines, else the next one never used.
+    // waits for a destroyed machine's shard to let go of it rather than
+    // failing while one is still on the way
+    machine_id allocate_id() {
+        for (;;) {
+            // read first: a retirement that ends after this has freed its id
+            // by the time the free list is looked at
+            const std::size_t retiring = m_retiring.load();
+            {
+                std::lock_guard<std::mutex> lock(m_free_mutex);
+                if (!m_free.empty()) {
+                    const machine_id id = m_free.back();
+                    m_free.pop_back();
+                    return id;
+                }
+            }
+            machine_id id = m_next_id.load();
+            while (id < m_opts.max_machines) {
+                if (m_next_id.compare_exchange_weak(id, id + 1)) {
+                    return id;
+                }
+            }
+            if (retiring == 0 || m_stop.load()) {
+                throw std::length_error("sharded_executor: max_machines reached");
+            }
+            std::this_thread::yield();
+        }
+    }
+
+    /*
+     * queues make() to the machine's owner. the command is announced in
+     * inflight before committing to an owner, so a concurrent migration or
+     * retirement either sees it or we see the new owner. bound to the
+     * machine live when it is called: false once that one is gone
+     */
+    template <typename Make>
+    bool route(machine_id id, bool counted, Make && make) {
+        check(id);
+        slot &s = m_slots[id];
+        const std::uint32_t epoch = s.epoch.load();
+        if (counted && !s.alive.load()) {
+            return false;
+        }
+        for (;;) {
+            const std::uint32_t owner = s.owner.load();
+            if (owner == no_owner || s.epoch.load() != epoch) {
+                return false;
+            }
+            if (owner == migrating) {
+                std::this_thread::yield();
+                continue;
+            }
+
+            s.inflight.fetch_add(1);
+            if (s.owner.load() != owner || s.epoch.load() != epoch) {
+                s.inflight.fetch_sub(1);
+                continue;
+            }
+            shard &target = *m_shards[owner];
+            if (counted) {
+                target.backlog.fetch_add(1, std::memory_order_relaxed);
+            }
+            if (!target.inbox.emplace(make())) {
+                if (counted) {
+                    target.backlog.fetch_sub(1, std::memory_order_relaxed);
+                }
+                s.inflight.fetch_sub(1);
+                return false;
+            }
+            return true;
+        }
+    }
+
+    void run(std::size_t index) {
+        pin(index);
+
+        shard &self = *m_shards[index];
+        unsigned idle = 0;
+        for (;;) {
+            std::size_t n = 0;
+            while (command *cmd = self.inbox.front()) {
+                execute(index, *cmd);
+                self.inbox.pop();
+                if (++n == 256) {
+                    break;
+                }
+            }
+            retire_pending(index);
+
+            if (n > 0) {
+                idle = 0;
+                continue;
+            }
+            if (m_stop.load(std::memory_order_relaxed)) {
+                return;
+            }
+            if (m_opts.work_stealing) {
+                request_steal(index);
+            }
+            if (++idle < 64) {
+                std::this_thread::yield();
+            } else {
+                std::this_thread::sleep_for(std::chrono::microseconds(50));
+            }
+        }
+    }
+
+    void execute(std::size_t index, command &cmd) {
+        shard &self = *m_shards[index];
+
+        if (auto *d = std::get_if<deliver>(&cmd)) {
+            machine &m = *m_machines[d->id];
+            guarded(d->id, [&] {
+                std::visit([&](auto & evt) {
+                    m.push(std::move(evt));
+                }, d->evt);
+            });
+            m_slots[d->id].inflight.fetch_sub(1);
+            self.backlog.fetch_sub(1, std::memory_order_relaxed);
+        } else if (auto *s = std::get_if<start_cmd>(&cmd)) {
+            adopt_machine(self, s->id);
+            guarded(s->id, [&] {
+                s->start(*m_machines[s->id]);
+            });
+            m_slots[s->id].inflight.fetch_sub(1);
+        } else if (auto *a = std::get_if<adopt>(&cmd)) {
+            adopt_machine(self, a->id);
+        } else if (auto *st = std::get_if<steal>(&cmd)) {
+            give_away(index, st->thief);
+        } else if (auto *r = std::get_if<retire>(&cmd)) {
+            m_slots[r->id].inflight.fetch_sub(1);
+            self.retiring.push_back(r->id);
+            retire_pending(index);
+        }
+    }
+
+    // runs f for machine id, handing what it throws to on_error so the
+    // command's bookkeeping still happens
+    template <typename F>
+    void guarded(machine_id id, F && f) {
+        try {
+            f();
+        } catch (...) {
+            if (m_opts.on_error) {
+                m_opts.on_error(id, std::current_exception());
+            }
+        }
+    }
+
+    // deletes the destroyed machines nothing is in flight for any more
+    void retire_pending(std::size_t index) {
+        shard &self = *m_shards[index];
+        for (std::size_t i = self.retiring.size(); i-- > 0;) {
+            if (try_retire(index, self.retiring[i])) {
+                self.retiring[i] = self.retiring.back();
+                self.retiring.pop_back();
+            }
+        }
+    }
+
+    // as for a migration: block posts, then make sure nobody slipped one in
+    bool try_retire(std::size_t index, machine_id id) {
+        shard &self = *m_shards[index];
+        slot &s = m_slots[id];
+        if (s.inflight.load() != 0) {
+            return false;
+        }
+        s.owner.store(migrating);
+        if (s.inflight.load() != 0) {
+            s.owner.store(static_cast<std::uint32_t>(index));
+            return false;
+        }
+        s.epoch.fetch_add(1);
+        s.owner.store(no_owner);
+
+        m_machines[id].reset();
+        self.owned.erase(std::find(self.owned.begin(), self.owned.end(), id));
+        self.machines.fetch_sub(1, std::memory_order_relaxed);
+
+        {
+            std::lock_guard<std::mutex> lock(m_free_mutex);
+            m_free.push_back(id);
+        }
+        m_retiring.fetch_sub(1);
+        return true;
+    }
+
+    void adopt_machine(shard &self, machine_id id) {
+        self.owned.push_back(id);
+        self.machines.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // idle shard: ask the busiest other shard for some of its machines
+    void request_steal(std::size_t index) {
+        std::size_t victim = index, depth = m_opts.steal_depth;
+        for (std::size_t i = 0; i < m_shards.size(); ++i) {
+            const std::size_t d = queue_depth(i);
+            if (i != index && d > depth) {
+                victim = i;
+                depth = d;
+            }
+        }
+        if (victim == index || m_shards[victim]->steal_pending.exchange(true)) {
+            return;
+        }
+        if (!m_shards[victim]->inbox.emplace(steal{static_cast<std::uint32_t>(index)})) {
+            m_shards[victim]->steal_pending.store(false);
+        }
+    }
+
+    // victim side of a steal: hand up to half of the quiescent machines over
+    void give_away(std::size_t index, std::uint32_t thief) {
+        shard &self = *m_shards[index];
+        const std::uint32_t me = static_cast<std::uint32_t>(index);
+
+        std::size_t budget = std::min<std::size_t>(self.owned.size() / 2, 64);
+        for (std::size_t i = self.owned.size(); i-- > 0 && budget > 0;) {
+            const machine_id id = self.owned[i];
+            slot &s = m_slots[id];
+            if (s.inflight.load() != 0 || !s.alive.load()) {
+                continue;
+            }
+
+            // block new posts, then make sure nobody slipped one in
+            s.owner.store(migrating);
+            if (s.inflight.load() != 0) {
+                s.owner.store(me);
+                continue;
+            }
+            // adopt is queued before the owner flips, so anything posted to
+            // the thief from now on lands behind it
+            if (!m_shards[thief]->inbox.emplace(adopt{id})) {
+                s.owner.store(me);
+                break;
+            }
+            s.owner.store(thief);
+
+            self.owned[i] = self.owned.back();
+            self.owned.pop_back();
+            self.machines.fetch_sub(1, std::memory_order_relaxed);
+            --budget;
+        }
+        self.steal_pending.store(false);
+    }
+
+    void pin(std::size_t index) {
+#ifdef __linux__
+        if (m_opts.pin_threads) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(index % CPU_SETSIZE, &set);
+            pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        }
+#else
+        (void)index;
+#endif
+    }
+
+    executor_options m_opts;
+    std::unique_ptr<slot[]> m_slots;
+    std::vector<std::unique_ptr<machine>> m_machines;   // each touched only by its owner
+    std::vector<std::unique_ptr<shard>> m_shards;
+    std::atomic<machine_id> m_next_id{0};
+    std::atomic<std::uint32_t> m_next_shard{0};
+    std::mutex m_free_mutex;
+    std::vector<machine_id> m_free;
+    std::atomic<std::size_t> m_retiring{0};     // destroyed, id not free yet
+    std::atomic<bool> m_stop{false};
+};
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+#include <variant>
+
+#include "fsm.hpp"
+#include "mpsc_queue.hpp"
+
+/*
+ * inbox_machine is a state_machine that other threads can post events to.
+ *
+ * post() may be called from any thread: it copies (or moves) the event into
+ * a lock-free bounded inbox of the table's event variant and returns false
+ * when the inbox is full. the owning thread executes the transitions with
+ * run_one() or drain(), exactly as if it had pushed the events itself, so
+ * states, context and trace still only ever run on that one thread.
+ */
+template <typename TransitionTable, typename Context = bool, typename Policy = default_policy>
+class inbox_machine : public state_machine<TransitionTable, Context, Policy> {
+    using base = state_machine<TransitionTable, Context, Policy>;
+
+public:
+    using events = typename base::events;
+
+    // inbox_capacity must be a power of two, the rest goes to state_machine
+    template <typename ... Args>
+    explicit inbox_machine(std::size_t inbox_capacity, Args && ... args) :
+        base(std::forward<Args>(args)...),
+        m_inbox(inbox_capacity)
+    {}
+
+    // any thread
+    template <typename Event>
+    bool post(Event && evt) {
+        using event_type = std::decay_t<Event>;
+        static_assert(contains_v<event_type, events>, "only events listed in the transition table can be posted");
+        return m_inbox.emplace(std::in_place_type<event_type>, std::forward<Event>(evt));
+    }
+
+    // owning thread: executes the oldest posted event, false if there was none
+    bool run_one() {
+        events *evt = m_inbox.front();
+        if (!evt) {
+            return false;
+        }
+        // popped even if the transition throws, the event is not retried
+        pop_guard guard{m_inbox};
+        std::visit([this](auto & e) {
+            this->push(std::move(e));
+        }, *evt);
+        return true;
+    }
+
+    // owning thread: executes up to max posted events, returns how many ran
+    std::size_t drain(std::size_t max = SIZE_MAX) {
+        std::size_t n = 0;
+        while (n < max && run_one()) {
+            ++n;
+        }
+        return n;
+    }
+
+    // any thread, approximate
+    std::size_t pending() const { return m_inbox.size_approx(); }
+
+private:
+    struct pop_guard {
+        mpsc_queue<events> &m_queue;
+        ~pop_guard() { m_queue.pop(); }
+    };
+
+    mpsc_queue<events> m_inbox;
+};
@@ -0,0 +1,467 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "fsm.hpp"
+
+/*
+ * binary journal of what machines do, for audit and for replaying an
+ * incident. journal_trace is a trace policy that appends one fixed-size
+ * journal_record per transition, unmatched event, start and external
+ * event, carrying the compile-time indices of the state, event, next state
+ * and table row instead of names:
+ *
+ *   struct audited : default_policy { using trace = journal_trace<transitions>; };
+ *
+ *   journal::open(std::fopen("fsm.journal", "wb"));
+ *   ...
+ *   journal::close();
+ *
+ * records go into a lock-free ring owned by the recording thread and a
+ * background writer moves them to the file in batches, so the machine only
+ * ever pays for a clock read and a memcpy. when a ring is full the record
+ * is dropped and counted, so the machine never waits for the disk, unless
+ * journal_options::wait_when_full asks for a complete journal. external
+ * events of a trivially copyable type up to MaxPayload bytes carry their
+ * bytes, which is what replay() needs to drive a machine again.
+ *
+ * records of one machine are written by whichever threads ran it, so
+ * read_journal() orders them by time. journal_trace gives each machine its
+ * own id and needs one trace per machine, i.e. not a machine_pool.
+ */
+struct journal_record {
+    enum kind_type : std::uint16_t { padding, start, external, transition, unmatched };
+
+    static constexpr std::uint16_t none = UINT16_MAX;
+
+    std::uint64_t time;         // steady_clock nanoseconds
+    std::uint32_t machine;      // journal_trace::id() of the machine
+    std::uint32_t table;        // hash of the machine's state types
+    std::uint16_t kind;
+    std::uint16_t state;        // index into states, none for external events
+    std::uint16_t event;        // index into events, event_count for other types
+    std::uint16_t next;         // transition: index into states
+    std::uint16_t row;          // transition: index into the flattened table
+    std::uint16_t size;         // payload bytes after the record
+    std::uint32_t reserved;
+};
+
+static_assert(sizeof(journal_record) == 32, "journal_record is a fixed 32 byte record");
+
+// the start of every journal file
+struct journal_file_header {
+    std::uint32_t magic;
+    std::uint16_t version;
+    std::uint16_t record_size;
+};
+
+inline constexpr std::uint32_t journal_magic   = 0x4a4d5346;    // "FSMJ"
+inline constexpr std::uint16_t journal_version = 1;
+
+namespace detail {
+    /*
+     * single producer, single consumer byte ring. a record and its payload
+     * are always contiguous: one that does not fit before the end is
+     * preceded by a padding record, or, with less than a record left, by
+     * bytes the consumer skips.
+     */
+    class journal_ring {
+    public:
+        // capacity: a power of two
+        explicit journal_ring(std::size_t capacity) :
+            m_buffer(new unsigned char[capacity]),
+            m_capacity(capacity)
+        {}
+
+        // producer. false if there is not enough room
+        bool append(const journal_record &r, const void *payload) {
+            const std::size_t n = align(sizeof(r) + r.size);
+            const std::size_t head = m_head.load(std::memory_order_relaxed);
+            const std::size_t tail = m_tail.load(std::memory_order_acquire);
+            const std::size_t at = head & (m_capacity - 1);
+            const std::size_t to_end = m_capacity - at;
+            const std::size_t skip = to_end < n ? to_end : 0;
+
+            if (m_capacity - (head - tail) < skip + n) {
+                return false;
+            }
+            if (skip >= sizeof(journal_record)) {
+                journal_record pad{};
+                pad.kind = journal_record::padding;
+                std::memcpy(m_buffer.get() + at, &pad, sizeof(pad));
+            }
+            unsigned char *p = m_buffer.get() + ((head + skip) & (m_capacity - 1));
+            std::memcpy(p, &r, sizeof(r));
+            if (r.size) {
+                std::memcpy(p + sizeof(r), payload, r.size);
+            }
+            m_head.store(head + skip + n, std::memory_order_release);
+            return true;
+        }
+
+        // consumer. appends every complete record to out, false if there was none
+        bool drain(std::vector<unsigned char> &out) {
+            const std::size_t head = m_head.load(std::memory_order_acquire);
+            std::size_t tail = m_tail.load(std::memory_order_relaxed);
+            if (tail == head) {
+                return false;
+            }
+            while (tail != head) {
+                const std::size_t at = tail & (m_capacity - 1);
+                const std::size_t to_end = m_capacity - at;
+                if (to_end < sizeof(journal_record)) {
+                    tail += to_end;
+                    continue;
+                }
+                journal_record r;
+                std::memcpy(&r, m_buffer.get() + at, sizeof(r));
+                if (r.kind == journal_record::padding) {
+                    tail += to_end;
+                    continue;
+                }
+                const std::size_t n = sizeof(r) + r.size;
+                out.insert(out.end(), m_buffer.get() + at, m_buffer.get() + at + n);
+                tail += align(n);
+            }
+            m_tail.store(tail, std::memory_order_release);
+            return true;
+        }
+
+        // set by the producer for the whole of journal::append(), so close()
+        // can wait for an append that saw the journal still open
+        std::atomic<bool> &appending() { return m_appending; }
+
+    private:
+        static std::size_t align(std::size_t n) { return (n + 7) & ~std::size_t(7); }
+
+        std::unique_ptr<unsigned char[]> m_buffer;
+        std::size_t m_capacity;
+
+        alignas(64) std::atomic<std::size_t> m_head{0};
+        std::atomic<bool> m_appending{false};       // on the producer's line
+        alignas(64) std::atomic<std::size_t> m_tail{0};
+    };
+}
+
+
+struct journal_options {
+    std::size_t ring_capacity = 1 << 20;                    // bytes per recording thread, power of two
+    std::chrono::microseconds interval{200};                // writer sleep when all rings are empty
+    bool wait_when_full = false;                            // lose nothing: a full ring stalls its thread
+};
+
+/*
+ * the process-wide journal: per-thread rings and the background writer.
+ * open() and close() are meant for process setup and shutdown, append()
+ * may be called from any thread at any time and does nothing while the
+ * journal is closed.
+ */
+class journal {
+public:
+    // rings of threads that already recorded keep their size
+    static void open(std::FILE *out, journal_options opts = journal_options()) {
+        std::lock_guard<std::mutex> lock(state().mutex);
+        if (state().writer.joinable() || !out) {
+            return;
+        }
+        const journal_file_header header{journal_magic, journal_version, sizeof(journal_record)};
+        std::fwrite(&header, sizeof(header), 1, out);
+
+        state().out = out;
+        state().opts = opts;
+        state().running.store(true);
+        state().writer = std::thread([interval = opts.interval] {
+            std::vector<unsigned char> batch;
+            while (state().running.load(std::memory_order_relaxed)) {
+                if (!flush_rings(batch)) {
+                    std::this_thread::sleep_for(interval);
+                }
+            }
+        });
+        state().open.store(true, std::memory_order_release);
+    }
+
+    // stops recording, writes what is left and flushes the file. a record
+    // appended concurrently is either written or counted in dropped(). the
+    // file stays open, it belongs to the caller
+    static void close() {
+        std::lock_guard<std::mutex> lock(state().mutex);
+        if (!state().writer.joinable()) {
+            return;
+        }
+        state().open.store(false);
+
+        // appends that got past the check of open finish into their rings
+        // first, with the writer still draining for those that wait_when_full
+        std::vector<detail::journal_ring *> rings;
+        {
+            std::lock_guard<std::mutex> rings_lock(state().rings_mutex);
+            for (auto &ring : state().rings) {
+                rings.push_back(ring.get());
+            }
+        }
+        for (detail::journal_ring *ring : rings) {
+            while (ring->appending().load()) {
+                std::this_thread::yield();
+            }
+        }
+        state().running.store(false);
+        state().writer.join();
+
+        std::vector<unsigned char> batch;
+        flush_rings(batch);
+        std::fflush(state().out);
+        state().out = nullptr;
+    }
+
+    static bool is_open() { return state().open.load(std::memory_order_relaxed); }
+
+    // records lost to full rings
+    static std::uint64_t dropped() { return state().dropped.load(std::memory_order_relaxed); }
+
+    static void append(const journal_record &r, const void *payload = nullptr) {
+        if (!state().open.load(std::memory_order_acquire)) {
+            return;
+        }
+        detail::journal_ring &ring = local();
+
+        // against close(): either it sees the flag and waits, or we see
+        // it closed. both sides are sequentially consistent for that
+        ring.appending().store(true);
+        if (state().open.load()) {
+            while (!ring.append(r, payload)) {
+                if (!state().opts.wait_when_full || !state().running.load(std::memory_order_relaxed)) {
+                    state().dropped.fetch_add(1, std::memory_order_relaxed);
+                    break;
+                }
+                std::this_thread::yield();
+            }
+        }
+        ring.appending().store(false, std::memory_order_release);
+    }
+
+    static std::uint64_t now() {
+        return std::uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+
+private:
+    struct shared {
+        std::mutex mutex;                   // open and close
+        std::mutex rings_mutex;             // the list of rings
+        std::vector<std::unique_ptr<detail::journal_ring>> rings;
+        std::thread writer;
+        std::FILE *out = nullptr;
+        journal_options opts;
+        std::atomic<bool> open{false};
+        std::atomic<bool> running{false};
+        std::atomic<std::uint64_t> dropped{0};
+    };
+
+    static shared &state() {
+        static shared s;
+        return s;
+    }
+
+    // rings live as long as the process, a finished thread's records are still written
+    static detail::journal_ring &local() {
+        thread_local detail::journal_ring *ring = [] {
+            std::lock_guard<std::mutex> lock(state().rings_mutex);
+            state().rings.emplace_back(new detail::journal_ring(state().opts.ring_capacity));
+            return state().rings.back().get();
+        }();
+        return *ring;
+    }
+
+    // writer thread, or close() once the writer is gone
+    static bool flush_rings(std::vector<unsigned char> &batch) {
+        batch.clear();
+        {
+            std::lock_guard<std::mutex> lock(state().rings_mutex);
+            for (auto &ring : state().rings) {
+                ring->drain(batch);
+            }
+        }
+        if (batch.empty()) {
+            return false;
+        }
+        std::fwrite(batch.data(), 1, batch.size(), state().out);
+        return true;
+    }
+};
+
+
+template <typename TransitionTable, std::size_t MaxPayload = 64>
+class journal_trace {
+    using machine_type = state_machine<TransitionTable>;
+
+public:
+    using states = typename machine_type::states;
+    using events = typename machine_type::events;
+
+    static constexpr std::uint32_t table_hash = detail::states_hash<states>::value;
+
+    journal_trace() : m_id(next_id().fetch_add(1, std::memory_order_relaxed)) {}
+
+    // the machine's id in the journal, unique within the process
+    std::uint32_t id() const { return m_id; }
+
+    template <typename State>
+    void on_start() {
+        append(journal_record::start, index_of_v<State, states>, journal_record::none,
+               journal_record::none, journal_record::none);
+    }
+
+    // told the row the machine took, guards and all
+    template <typename State, typename Event, typename Next, std::size_t Row>
+    void on_transition(const Event &) {
+        append(journal_record::transition, index_of_v<State, states>, index_of_v<Event, events>,
+               index_of_v<Next, states>, Row);
+    }
+
+    template <typename State, typename Event>
+    void on_unmatched(const Event &) {
+        append(journal_record::unmatched, index_of_v<State, states>, index_of_v<Event, events>,
+               journal_record::none, journal_record::none);
+    }
+
+    template <typename Event>
+    void on_external(const Event &evt) {
+        if (!journal::is_open()) {
+            return;
+        }
+        journal_record r = record(journal_record::external, journal_record::none, index_of_v<Event, events>,
+                                  journal_record::none, journal_record::none);
+        if constexpr (std::is_trivially_copyable_v<Event> && sizeof(Event) <= MaxPayload) {
+            r.size = sizeof(Event);
+            journal::append(r, &evt);
+        } else {
+            journal::append(r);
+        }
+    }
+
+private:
+    journal_record record(std::uint16_t kind, std::size_t state, std::size_t event, std::size_t next, std::size_t row) const {
+        journal_record r{};
+        r.time    = journal::now();
+        r.machine = m_id;
+        r.table   = table_hash;
+        r.kind    = kind;
+        r.state   = std::uint16_t(state);
+        r.event   = std::uint16_t(event);
+        r.next    = std::uint16_t(next);
+        r.row     = std::uint16_t(row);
+        return r;
+    }
+
+    void append(std::uint16_t kind, std::size_t state, std::size_t event, std::size_t next, std::size_t row) const {
+        if (journal::is_open()) {
+            journal::append(record(kind, state, event, next, row));
+        }
+    }
+
+    static std::atomic<std::uint32_t> &next_id() {
+        static std::atomic<std::uint32_t> id{0};
+        return id;
+    }
+
+    std::uint32_t m_id;
+};
+
+
+// one record read back, with its payload
+struct journal_entry {
+    journal_record record;
+    std::vector<unsigned char> payload;
+};
+
+// reads a whole journal, ordered by time. false if it is not one or was cut short
+inline bool read_journal(std::FILE *in, std::vector<journal_entry> &entries) {
+    journal_file_header header;
+    if (std::fread(&header, sizeof(header), 1, in) != 1 || header.magic != journal_magic ||
+        header.version != journal_version || header.record_size != sizeof(journal_record)) {
+        return false;
+    }
+    bool complete = true;
+    journal_entry e;
+    while (std::fread(&e.record, sizeof(e.record), 1, in) == 1) {
+        e.payload.resize(e.record.size);
+        if (e.record.size && std::fread(e.payload.data(), 1, e.record.size, in) != e.record.size) {
+            complete = false;
+            break;
+        }
+        entries.push_back(e);
+    }
+    std::stable_sort(entries.begin(), entries.end(), [](const journal_entry &a, const journal_entry &b) {
+        return a.record.time < b.record.time;
+    });
+    return complete;
+}
+
+
+namespace detail {
+    template <typename Event, typename Push>
+    bool replay_as(const journal_entry &e, Push &push) {
+        if constexpr (std::is_trivially_copyable_v<Event>) {
+            if (e.payload.size() != sizeof(Event)) {
+                return false;
+            }
+            std::aligned_storage_t<sizeof(Event), alignof(Event)> bytes;
+            std::memcpy(&bytes, e.payload.data(), sizeof(Event));
+            push(Event(*std::launder(reinterpret_cast<const Event *>(&bytes))));
+            return true;
+        } else {
+            return false;
+        }
+    }
+
+    template <typename Events, typename Push, std::size_t ... Is>
+    bool replay_event(const journal_entry &e, Push &push, std::index_sequence<Is...>) {
+        bool pushed = false;
+        (void)((e.record.event == Is && (pushed = replay_as<std::variant_alternative_t<Is, Events>>(e, push), true)) || ...);
+        return pushed;
+    }
+}
+
+struct replay_result {
+    std::size_t replayed = 0;   // events pushed
+    std::size_t skipped  = 0;   // external events journaled without their bytes
+};
+
+/*
+ * pushes the external events journaled for machine id, in order, through
+ * push(evt), e.g. [&](auto &&evt) { fsm.push(evt); } on a derived machine
+ * that exposes push(). Machine is the journaled machine's type; start the
+ * machine in the state the journal's start record names (or restore() it
+ * from a snapshot) first. states that emit the same events for the same
+ * input then take exactly the journaled transitions again.
+ */
+template <typename Machine, typename Push>
+replay_result replay(const std::vector<journal_entry> &entries, std::uint32_t id, Push && push) {
+    using events = typename Machine::events;
+    replay_result result;
+    for (const journal_entry &e : entries) {
+        if (e.record.machine != id || e.record.kind != journal_record::external ||
+            e.record.table != detail::states_hash<typename Machine::states>::value) {
+            continue;
+        }
+        if (!detail::replay_event<events>(e, push, std::make_index_sequence<size_of_v<events>>())) {
+            ++result.skipped;
+            continue;
+        }
+        ++result.replayed;
+    }
+    return result;
+}
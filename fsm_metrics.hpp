@@ -0,0 +1,217 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string_view>
+#include <utility>
+
+#include "fsm.hpp"
+
+/*
+ * metrics_trace is a trace policy that counts instead of printing:
+ *
+ *   transitions    per (state, event) pair, the same dense layout as the
+ *                  transition lookup
+ *   unmatched      per (state, event) pair that found no row, or whose
+ *                  guards all refused
+ *   time in state  per state, a log2 histogram of the nanoseconds spent in
+ *                  it before it was left
+ *
+ *   struct measured : default_policy { using trace = metrics_trace<transitions>; };
+ *   ...
+ *   metrics_trace<transitions>::snapshot().print();
+ *
+ * counters live in one preallocated block per thread and table, written
+ * only by that thread with plain relaxed stores, so recording is an
+ * increment with no shared cache lines. snapshot() sums the blocks of all
+ * threads that ever recorded and may run concurrently with them. blocks
+ * are never freed: counts of finished threads stay in the totals.
+ *
+ * time in state needs the time a state was entered, which the trace keeps
+ * per machine. a machine_pool shares one trace between all its machines,
+ * so use metrics_trace<Table, false> there to only count.
+ */
+template <typename TransitionTable, bool TimeInState = true, typename Clock = std::chrono::steady_clock>
+class metrics_trace {
+    using machine_type = state_machine<TransitionTable>;
+
+public:
+    using states = typename machine_type::states;
+    using events = typename machine_type::events;
+
+    static constexpr std::size_t state_count = size_of_v<states>;
+    static constexpr std::size_t event_count = size_of_v<events>;
+
+    // one column more than events: any type outside the table taken by an any_event row
+    static constexpr std::size_t event_columns = event_count + 1;
+
+    // bucket b counts stays of [2^b, 2^(b + 1)) ns, the last one everything longer
+    static constexpr std::size_t buckets = 40;
+
+    template <typename T>
+    using counters = std::array<std::array<T, event_columns>, state_count>;
+
+    struct report {
+        counters<std::uint64_t> transitions{};
+        counters<std::uint64_t> unmatched{};
+        std::array<std::array<std::uint64_t, buckets>, state_count> time_in_state{};
+
+        std::uint64_t total_transitions() const { return sum(transitions); }
+        std::uint64_t total_unmatched() const { return sum(unmatched); }
+
+        // every non-zero counter, one line each, with the type names
+        void print(std::FILE *out = stdout) const {
+            for (std::size_t s = 0; s < state_count; ++s) {
+                for (std::size_t e = 0; e < event_columns; ++e) {
+                    if (transitions[s][e]) {
+                        line(out, "transitions", s, e, transitions[s][e]);
+                    }
+                    if (unmatched[s][e]) {
+                        line(out, "unmatched", s, e, unmatched[s][e]);
+                    }
+                }
+            }
+            for (std::size_t s = 0; s < state_count; ++s) {
+                for (std::size_t b = 0; b < buckets; ++b) {
+                    if (time_in_state[s][b]) {
+                        const std::string_view n = state_names[s];
+                        std::fprintf(out, "time_in_state %.*s >= %llu ns: %llu\n", int(n.size()), n.data(),
+                                     (unsigned long long)(std::uint64_t(1) << b), (unsigned long long)time_in_state[s][b]);
+                    }
+                }
+            }
+        }
+
+    private:
+        static std::uint64_t sum(const counters<std::uint64_t> &c) {
+            std::uint64_t n = 0;
+            for (auto &row : c) {
+                for (auto v : row) {
+                    n += v;
+                }
+            }
+            return n;
+        }
+
+        static void line(std::FILE *out, const char *what, std::size_t s, std::size_t e, std::uint64_t n) {
+            const std::string_view sn = state_names[s], en = event_names[e];
+            std::fprintf(out, "%s %.*s + %.*s: %llu\n", what, int(sn.size()), sn.data(), int(en.size()), en.data(),
+                         (unsigned long long)n);
+        }
+    };
+
+    template <typename State>
+    void on_start() {
+        if constexpr (TimeInState) {
+            m_entered = Clock::now();
+        }
+    }
+
+    template <typename State, typename Event, typename Next>
+    void on_transition(const Event &) {
+        constexpr std::size_t s = index_of_v<State, states>;
+        block &b = local();
+        bump(b.transitions[s][index_of_v<Event, events>]);
+        if constexpr (TimeInState) {
+            const typename Clock::time_point now = Clock::now();
+            if (m_entered != typename Clock::time_point()) {
+                bump(b.time_in_state[s][bucket(now - m_entered)]);
+            }
+            m_entered = now;
+        }
+    }
+
+    template <typename State, typename Event>
+    void on_unmatched(const Event &) {
+        bump(local().unmatched[index_of_v<State, states>][index_of_v<Event, events>]);
+    }
+
+    // the totals of every thread so far
+    static report snapshot() {
+        report r;
+        std::lock_guard<std::mutex> lock(registry_mutex());
+        for (const block *b = registry_head(); b; b = b->next) {
+            for (std::size_t s = 0; s < state_count; ++s) {
+                for (std::size_t e = 0; e < event_columns; ++e) {
+                    r.transitions[s][e] += b->transitions[s][e].load(std::memory_order_relaxed);
+                    r.unmatched[s][e]   += b->unmatched[s][e].load(std::memory_order_relaxed);
+                }
+                for (std::size_t i = 0; i < buckets; ++i) {
+                    r.time_in_state[s][i] += b->time_in_state[s][i].load(std::memory_order_relaxed);
+                }
+            }
+        }
+        return r;
+    }
+
+private:
+    using counter = std::atomic<std::uint64_t>;
+
+    struct block {
+        counters<counter> transitions;
+        counters<counter> unmatched;
+        std::array<std::array<counter, buckets>, state_count> time_in_state;
+        const block *next;
+    };
+
+    // single writer: a load and a store, no locked read-modify-write
+    static void bump(counter &c) {
+        c.store(c.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    static std::size_t bucket(typename Clock::duration d) {
+        const std::uint64_t ns = std::uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(d).count());
+        if (ns == 0) {
+            return 0;
+        }
+    #if defined(__GNUC__) || defined(__clang__)
+        const std::size_t b = std::size_t(63 - __builtin_clzll(ns));
+    #else
+        std::size_t b = 0;
+        for (std::uint64_t v = ns; v >>= 1;) {
+            ++b;
+        }
+    #endif
+        return b < buckets ? b : buckets - 1;
+    }
+
+    static block &local() {
+        thread_local block *b = [] {
+            block *fresh = new block();
+            std::lock_guard<std::mutex> lock(registry_mutex());
+            fresh->next = registry_head();
+            registry_head() = fresh;
+            return fresh;
+        }();
+        return *b;
+    }
+
+    static std::mutex &registry_mutex() {
+        static std::mutex m;
+        return m;
+    }
+
+    static const block *&registry_head() {
+        static const block *head = nullptr;
+        return head;
+    }
+
+    template <std::size_t ... Is>
+    static constexpr std::array<std::string_view, state_count> names_of_states(std::index_sequence<Is...>) {
+        return {{ type_name<std::variant_alternative_t<Is, states>>()... }};
+    }
+
+    template <std::size_t ... Is>
+    static constexpr std::array<std::string_view, event_columns> names_of_events(std::index_sequence<Is...>) {
+        return {{ type_name<std::variant_alternative_t<Is, events>>()..., "other" }};
+    }
+
+    static constexpr std::array<std::string_view, state_count> state_names = names_of_states(std::make_index_sequence<state_count>());
+    static constexpr std::array<std::string_view, event_columns> event_names = names_of_events(std::make_index_sequence<event_count>());
+
+    typename Clock::time_point m_entered{};
+};
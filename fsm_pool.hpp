@@ -0,0 +1,401 @@
+#pragma once
+
+#include <cstdint>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "fsm.hpp"
+
+/*
+ * machine_pool runs many machines of the same transition table out of two
+ * contiguous arrays instead of one heap object per session:
+ *
+ *   m_index    the state index of every machine, narrowed to the smallest
+ *              unsigned type that fits (no_state marks a free slot)
+ *   m_storage  one slot per machine, big enough for the largest state
+ *
+ * a machine is just its id into both arrays. broadcast() and the batch
+ * push() walk the arrays linearly, so sending e.g. a timeout to every
+ * session is a single sweep over memory that is already adjacent.
+ *
+ * all machines share the pool's one Context and trace. Policy is the same
+ * as for state_machine, except that there is no transition arena; the
+ * dispatch backend is always a switch on the index. states' accept() hooks
+ * and the trace's on_external() work as they do in a state_machine.
+ */
+namespace detail {
+    template <typename List>
+    struct storage_for;
+
+    template <template <class...> class TT, class ... Ts>
+    struct storage_for<TT<Ts...>> {
+        using type = std::aligned_union_t<0, Ts...>;
+    };
+}
+
+template <typename TransitionTable, typename Context = bool, typename Policy = default_policy>
+class machine_pool {
+public:
+    using machine_type  = state_machine<TransitionTable, Context, Policy>;
+    using states        = typename machine_type::states;
+    using events        = typename machine_type::events;
+    using trace_type    = typename machine_type::trace_type;
+    using context_arg   = typename machine_type::context_arg;
+    using Callback      = typename machine_type::Callback;
+    using id_type       = std::uint32_t;
+
+    static constexpr std::size_t state_count      = size_of_v<states>;
+    static constexpr std::size_t transition_count = machine_type::transition_count;
+    static constexpr std::size_t queue_capacity   = machine_type::queue_capacity;
+
+    using index_type = smallest_unsigned_t<state_count>;
+    static constexpr index_type no_state = state_count;
+
+    static_assert(std::is_same_v<typename Policy::arena, no_arena>,
+                  "machine_pool has no transition arena, its Policy::arena must be no_arena");
+
+    explicit machine_pool(std::size_t capacity, Context ctx = Context()) :
+        m_ctx(std::move(ctx)),
+        m_index(capacity, no_state),
+        m_storage(capacity)
+    {
+        m_free.reserve(capacity);
+        for (std::size_t i = capacity; i-- > 0;) {
+            m_free.push_back(static_cast<id_type>(i));
+        }
+    }
+
+    machine_pool(const machine_pool &) = delete;
+    machine_pool &operator=(const machine_pool &) = delete;
+
+    ~machine_pool() {
+        for (std::size_t id = 0; id < m_index.size(); ++id) {
+            destroy(static_cast<id_type>(id));
+        }
+    }
+
+    std::size_t capacity() const { return m_index.size(); }
+    std::size_t size() const { return m_index.size() - m_free.size(); }
+
+    void set_callback(Callback cb) { m_cb = std::move(cb); }
+    trace_type &trace() { return m_trace; }
+    Context &context() { return m_ctx; }
+
+    // no_state if the slot is free
+    index_type state_index(id_type id) const { return m_index[id]; }
+
+    template <typename State>
+    bool is(id_type id) const { return m_index[id] == index_of_v<State, states>; }
+
+    // allocates a machine, enters StartState and runs its callback
+    template <typename StartState, typename ... Args>
+    id_type start(Args && ... args) {
+        static_assert(machine_type::template accepts_context<StartState, Args...>(),
+                      "state must be constructible from (context_arg, args...) without copying a by-reference context");
+        if (m_free.empty()) {
+            throw std::length_error("machine_pool is full");
+        }
+        const id_type id = m_free.back();
+        m_free.pop_back();
+
+        StartState *s = construct<StartState>(id, context_arg(m_ctx), std::forward<Args>(args)...);
+        detail::trace_start<StartState>(m_trace);
+        run([&] {
+            (*s)(emitter(id));
+        });
+        return id;
+    }
+
+    // destroys the machine's state and returns its slot to the pool. false
+    // if the slot is free already, e.g. released before or left by a state
+    // whose constructor threw
+    bool release(id_type id) {
+        if (m_index[id] == no_state) {
+            return false;
+        }
+        destroy(id);
+        m_free.push_back(id);
+        return true;
+    }
+
+    // moved through to the next state like state_machine::push, from an
+    // event the pool owns
+    template <typename E>
+    void push(id_type id, E && evt) {
+        detail::trace_external(m_trace, std::as_const(evt));
+        emit(id, std::forward<E>(evt));
+    }
+
+    // the same event to each of count machines, copied into every state
+    template <typename Event>
+    void push(const id_type *ids, std::size_t count, const Event &evt) {
+        run([&] {
+            for (std::size_t i = 0; i < count; ++i) {
+                detail::trace_external(m_trace, evt);
+                dispatch(ids[i], evt);
+                drain();
+            }
+        });
+    }
+
+    // the same event to every live machine, in id order
+    template <typename Event>
+    void broadcast(const Event &evt) {
+        run([&] {
+            const std::size_t n = m_index.size();
+            for (std::size_t id = 0; id < n; ++id) {
+                if (m_index[id] != no_state) {
+                    detail::trace_external(m_trace, evt);
+                    dispatch(static_cast<id_type>(id), evt);
+                    drain();
+                }
+            }
+        });
+    }
+
+private:
+    // an event for machine id emitted by its state, or pushed from outside
+    template <typename E>
+    void emit(id_type id, E && evt) {
+        using Event = std::decay_t<E>;
+
+        if constexpr (queue_capacity > 0 && (contains_v<Event, events> || machine_type::has_wildcard || machine_type::accepts_unlisted)) {
+            if (m_running) {
+                bool queued;
+                if constexpr (contains_v<Event, events>) {
+                    queued = m_queue.emplace(id, std::forward<E>(evt));
+                } else {
+                    queued = m_queue.emplace(id, std::in_place_type<foreign_type>, std::forward<E>(evt), &dispatch_foreign<Event>);
+                }
+                if (!queued && m_cb) {
+                    m_cb(std::make_error_code(std::errc::no_buffer_space));
+                }
+                return;
+            }
+        }
+        Event owned(std::forward<E>(evt));
+        run([&] {
+            dispatch(id, owned);
+        });
+    }
+
+    using slot_type = typename detail::storage_for<states>::type;
+
+    // as in state_machine, events outside the table's list are queued
+    // type-erased when an any_event row or an accept() can take them
+    using foreign_type  = detail::foreign_event<Policy::foreign_event_size, machine_pool &, id_type>;
+    using queued_events = std::conditional_t<queue_capacity != 0 && (machine_type::has_wildcard || machine_type::accepts_unlisted),
+                                             merge_t<std::variant, events, std::variant<foreign_type>>, events>;
+
+    struct pending {
+        template <typename Event>
+        pending(id_type id, Event && evt) :
+            id(id),
+            evt(std::in_place_type<std::decay_t<Event>>, std::forward<Event>(evt))
+        {}
+
+        template <typename Event>
+        pending(id_type id, std::in_place_type_t<foreign_type> t, Event && evt, typename foreign_type::dispatch_type dispatch) :
+            id(id),
+            evt(t, std::forward<Event>(evt), dispatch)
+        {}
+
+        id_type id;
+        queued_events evt;
+    };
+
+    template <typename Event>
+    static void dispatch_foreign(void *evt, machine_pool &pool, id_type id) {
+        pool.dispatch(id, *static_cast<Event *>(evt));
+    }
+
+    struct run_guard {
+        run_guard(bool &flag) : m_flag(flag) { m_flag = true; }
+        ~run_guard() { m_flag = false; }
+        bool &m_flag;
+    };
+
+    // a state's callback, as state_machine's: external() pushes an event
+    // traced as coming from outside
+    class emitter_type {
+    public:
+        emitter_type(machine_pool *pool, id_type id) : m_pool(pool), m_id(id) {}
+
+        template <typename E>
+        void operator()(E && evt) const { m_pool->emit(m_id, std::forward<E>(evt)); }
+
+        template <typename E>
+        void external(E && evt) const { m_pool->push(m_id, std::forward<E>(evt)); }
+
+    private:
+        machine_pool *m_pool;
+        id_type m_id;
+    };
+
+    emitter_type emitter(id_type id) { return emitter_type(this, id); }
+
+    // runs f as the outermost dispatch, then drains what it emitted
+    template <typename F>
+    void run(F && f) {
+        if constexpr (queue_capacity == 0) {
+            f();
+        } else if (m_running) {
+            f();
+        } else {
+            run_guard guard(m_running);
+            try {
+                f();
+                drain();
+            } catch (...) {
+                // what is still queued may be for a slot the throw freed
+                while (!m_queue.empty()) {
+                    m_queue.pop();
+                }
+                throw;
+            }
+        }
+    }
+
+    void drain() {
+        if constexpr (queue_capacity > 0) {
+            while (!m_queue.empty()) {
+                pending &p = m_queue.front();
+                std::visit([&](auto & evt) {
+                    if constexpr (std::is_same_v<std::decay_t<decltype(evt)>, foreign_type>) {
+                        evt.dispatch(*this, p.id);
+                    } else {
+                        dispatch(p.id, evt);
+                    }
+                }, p.evt);
+                m_queue.pop();
+            }
+        }
+    }
+
+    template <typename State>
+    State &get(id_type id) {
+        return *std::launder(reinterpret_cast<State *>(&m_storage[id]));
+    }
+
+    // a constructor that throws leaves the slot empty, so it goes back to
+    // the free list: the machine is gone
+    template <typename State, typename ... Args>
+    State *construct(id_type id, Args && ... args) {
+        State *s;
+        try {
+            s = ::new (static_cast<void *>(&m_storage[id])) State(std::forward<Args>(args)...);
+        } catch (...) {
+            m_index[id] = no_state;
+            m_free.push_back(id);
+            throw;
+        }
+        m_index[id] = index_of_v<State, states>;
+        return s;
+    }
+
+    void destroy(id_type id) {
+        destroy_indexed(id, std::make_index_sequence<state_count>());
+        m_index[id] = no_state;
+    }
+
+    template <std::size_t ... Is>
+    void destroy_indexed(id_type id, std::index_sequence<Is...>) {
+        const std::size_t index = m_index[id];
+        (void)((index == Is && (destroy_as<std::variant_alternative_t<Is, states>>(id), true)) || ...);
+    }
+
+    template <typename State>
+    void destroy_as(id_type id) {
+        get<State>(id).~State();
+    }
+
+    template <typename Event>
+    void dispatch(id_type id, Event & evt) {
+        dispatch_indexed(id, evt, std::make_index_sequence<state_count>());
+    }
+
+    template <typename Event, std::size_t ... Is>
+    void dispatch_indexed(id_type id, Event & evt, std::index_sequence<Is...>) {
+        const std::size_t index = m_index[id];
+        if (index == no_state) {
+            throw std::invalid_argument("machine_pool: event for a released machine");
+        }
+        (void)((index == Is && (handle(id, get<std::variant_alternative_t<Is, states>>(id), evt), true)) || ...);
+    }
+
+    template <typename State, typename Event>
+    void handle(id_type id, State & current_state, Event & evt) {
+        using event_type = std::decay_t<Event>;
+
+        if constexpr (detail::has_accept<State, event_type, emitter_type>::value) {
+            if constexpr (std::is_const_v<Event>) {
+                // a broadcast event, accept() may change it
+                event_type copy(evt);
+                handle(id, current_state, copy);
+                return;
+            } else if (current_state.accept(evt, emitter(id))) {
+                return;
+            }
+        }
+
+        if constexpr (machine_type::template transition_index<State, event_type> < transition_count) {
+            const bool taken = machine_type::template select_row<machine_type::template transition_index<State, event_type>>(current_state, evt, [&](auto row) {
+                process<decltype(row)::value>(id, current_state, evt);
+            });
+            if (!taken) {
+                unmatched(current_state, evt);
+            }
+        } else {
+            unmatched(current_state, evt);
+        }
+    }
+
+    template <typename State, typename Event>
+    void unmatched(State &, Event & evt) {
+        m_trace.template on_unmatched<State, std::decay_t<Event>>(evt);
+        if (m_cb) {
+            m_cb({});
+        }
+    }
+
+    // takes row Row, its guard already passed
+    template <std::size_t Row, typename State, typename Event>
+    void process(id_type id, State & current_state, Event & evt) {
+        using event_type = std::decay_t<Event>;
+        using transition_state_t = std::variant_alternative_t<Row, typename machine_type::transition_table>;
+        using next_state_t       = typename transition_state_t::next_state;
+
+        typename transition_state_t::action()(current_state, evt);
+
+        next_state_t *next;
+        if constexpr (machine_type::template accepts_context<next_state_t, previous<State>>()) {
+            next_state_t tmp(context_arg(m_ctx), previous<State>{current_state});
+            current_state.~State();
+            m_index[id] = no_state;
+            next = construct<next_state_t>(id, std::move(tmp));
+        } else {
+            static_assert(machine_type::template accepts_context<next_state_t>(),
+                          "state must be constructible from context_arg without copying a by-reference context");
+            current_state.~State();
+            m_index[id] = no_state;
+            next = construct<next_state_t>(id, context_arg(m_ctx));
+        }
+
+        detail::trace_transition<State, event_type, next_state_t, Row>(m_trace, evt);
+
+        // moves what the pool owns, copies a broadcast (const) event
+        (*next)(std::move(evt), emitter(id));
+    }
+
+    Context m_ctx;
+    std::vector<index_type> m_index;
+    std::vector<slot_type> m_storage;
+    std::vector<id_type> m_free;
+    Callback m_cb;
+    trace_type m_trace;
+    event_queue<pending, queue_capacity> m_queue;
+    bool m_running = false;
+};
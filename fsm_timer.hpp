@@ -0,0 +1,95 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+#include <variant>
+
+#include "fsm.hpp"
+#include "timer_wheel.hpp"
+
+/*
+ * timeouts for states. a state owns an fsm_timer and arms it with the
+ * callback it was given and the event to emit when it expires; the event
+ * goes through the transition table like any other:
+ *
+ *   struct connect_timeout {};
+ *
+ *   struct connecting {
+ *       connecting(timer_context<context> &ctx) : m_timeout(ctx.timers()) {}
+ *
+ *       template <typename Callable>
+ *       void operator()(success<sock>, Callable && cb) {
+ *           m_timeout.arm(std::chrono::seconds(5), cb, connect_timeout{});
+ *       }
+ *
+ *       fsm_timer<> m_timeout;
+ *   };
+ *
+ *   transition<connecting, connect_timeout, failed>
+ *
+ * leaving the state destroys the timer, which cancels it, so a timeout
+ * never reaches the state after the one that armed it. all machines of a
+ * thread share one timer_wheel that the thread's loop advances; the
+ * timeout events are pushed from there, as external events: a
+ * journal_trace records them, and replay() feeds them back in the order
+ * they fired without a wheel.
+ */
+template <std::size_t Capacity = 32>
+class fsm_timer : wheel_entry {
+public:
+    explicit fsm_timer(timer_wheel &wheel) : m_wheel(&wheel) {
+        on_expiry = &fsm_timer::expired;
+    }
+
+    fsm_timer(const fsm_timer &) = delete;
+    fsm_timer &operator=(const fsm_timer &) = delete;
+
+    ~fsm_timer() { cancel(); }
+
+    // evt to the machine once after `after`, replacing a timeout that is
+    // still pending. it arrives as an external event, like push(evt)
+    template <typename Rep, typename Period, typename Callable, typename Event>
+    void arm(std::chrono::duration<Rep, Period> after, Callable && cb, Event && evt) {
+        m_fire = [cb, evt = std::decay_t<Event>(std::forward<Event>(evt))]() mutable {
+            detail::emit_external(cb, std::move(evt));
+        };
+        m_wheel->schedule(*this, std::chrono::duration_cast<timer_wheel::clock::duration>(after));
+    }
+
+    void cancel() {
+        m_wheel->cancel(*this);
+        m_fire = nullptr;
+    }
+
+    bool armed() const { return linked(); }
+
+private:
+    // the callback may replace the state this timer lives in, so it is
+    // moved out before it runs
+    static void expired(wheel_entry &e) {
+        inplace_function<void(), Capacity> fire = std::move(static_cast<fsm_timer &>(e).m_fire);
+        fire();
+    }
+
+    timer_wheel *m_wheel;
+    inplace_function<void(), Capacity> m_fire;
+};
+
+
+// the user's Context plus the wheel its machine's timers go to
+template <typename Context = std::monostate>
+class timer_context : public Context {
+public:
+    template <typename ... Args>
+    explicit timer_context(timer_wheel &wheel, Args && ... args) :
+        Context(std::forward<Args>(args)...),
+        m_wheel(&wheel)
+    {}
+
+    timer_wheel &timers() const { return *m_wheel; }
+
+private:
+    timer_wheel *m_wheel;
+};
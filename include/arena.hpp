@@ -0,0 +1,116 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+
+/*
+ * monotonic bump allocator over a fixed buffer. allocate() is a pointer
+ * increment, freeing is a no-op and release() drops everything at once.
+ * requests that do not fit go to separately allocated heap chunks, which
+ * release() frees as well, so running out of space costs speed, never
+ * correctness.
+ */
+class monotonic_arena {
+public:
+    monotonic_arena(const monotonic_arena &) = delete;
+    monotonic_arena &operator=(const monotonic_arena &) = delete;
+
+    ~monotonic_arena() { release(); }
+
+    // align must be a power of two
+    void *allocate(std::size_t n, std::size_t align = alignof(std::max_align_t)) {
+        const std::size_t at = (m_top + align - 1) & ~(align - 1);
+        if (at <= m_size && m_size - at >= n) {
+            m_top = at + n;
+            return m_buf + at;
+        }
+        return overflow(n, align);
+    }
+
+    void release() {
+        while (m_chunks) {
+            chunk *c = m_chunks;
+            m_chunks = c->next;
+            ::operator delete(c);
+        }
+        m_top = 0;
+    }
+
+    std::size_t capacity() const { return m_size; }
+    std::size_t used() const { return m_top; }
+
+    // requests that did not fit the buffer since construction
+    std::size_t overflows() const { return m_overflows; }
+
+protected:
+    monotonic_arena(unsigned char *buf, std::size_t size) : m_buf(buf), m_size(size) {}
+
+private:
+    struct chunk {
+        chunk *next;
+    };
+
+    void *overflow(std::size_t n, std::size_t align) {
+        ++m_overflows;
+        chunk *c = static_cast<chunk *>(::operator new(sizeof(chunk) + n + align));
+        c->next = m_chunks;
+        m_chunks = c;
+        const std::uintptr_t p = reinterpret_cast<std::uintptr_t>(c + 1);
+        return reinterpret_cast<void *>((p + align - 1) & ~std::uintptr_t(align - 1));
+    }
+
+    unsigned char *m_buf;
+    std::size_t m_size;
+    std::size_t m_top = 0;
+    std::size_t m_overflows = 0;
+    chunk *m_chunks = nullptr;
+};
+
+// a monotonic_arena with its Size byte buffer inline
+template <std::size_t Size>
+class inline_arena : public monotonic_arena {
+public:
+    inline_arena() : monotonic_arena(m_storage, Size) {}
+
+private:
+    alignas(std::max_align_t) unsigned char m_storage[Size];
+};
+
+
+/*
+ * std allocator on top of a monotonic_arena, e.g.
+ *
+ *   using arena_string = std::basic_string<char, std::char_traits<char>, arena_allocator<char>>;
+ *   arena_string s("payload", arena_allocator<char>(arena));
+ *
+ * containers still reuse their own storage; when they free it, the memory
+ * stays in the arena until its next release().
+ */
+template <typename T>
+class arena_allocator {
+public:
+    using value_type = T;
+
+    arena_allocator(monotonic_arena &arena) noexcept : m_arena(&arena) {}
+
+    template <typename U>
+    arena_allocator(const arena_allocator<U> &other) noexcept : m_arena(other.arena()) {}
+
+    T *allocate(std::size_t n) {
+        return static_cast<T *>(m_arena->allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T *, std::size_t) noexcept {}
+
+    monotonic_arena *arena() const noexcept { return m_arena; }
+
+    template <typename U>
+    bool operator==(const arena_allocator<U> &other) const noexcept { return m_arena == other.arena(); }
+
+    template <typename U>
+    bool operator!=(const arena_allocator<U> &other) const noexcept { return m_arena != other.arena(); }
+
+private:
+    monotonic_arena *m_arena;
+};
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+/*
+ * std::function look-alike that never allocates: the callable is stored in
+ * a fixed Capacity byte buffer inside the object, and a callable that does
+ * not fit is a compile error instead of a silent heap allocation.
+ */
+template <typename Signature, std::size_t Capacity = 32, std::size_t Alignment = alignof(std::max_align_t)>
+class inplace_function;
+
+template <typename R, typename ... Args, std::size_t Capacity, std::size_t Alignment>
+class inplace_function<R(Args...), Capacity, Alignment> {
+public:
+    inplace_function() noexcept = default;
+    inplace_function(std::nullptr_t) noexcept {}
+
+    template <typename F, typename T = std::decay_t<F>,
+              typename = std::enable_if_t<!std::is_same_v<T, inplace_function> &&
+                                          std::is_invocable_r_v<R, T &, Args...>>>
+    inplace_function(F && f) {
+        static_assert(sizeof(T) <= Capacity, "callable too large for inplace_function, raise Capacity");
+        static_assert(Alignment % alignof(T) == 0, "callable over-aligned for inplace_function");
+        static_assert(std::is_nothrow_move_constructible_v<T>, "inplace_function needs a noexcept movable callable");
+        static_assert(std::is_copy_constructible_v<T>, "inplace_function needs a copyable callable, like std::function");
+
+        ::new (static_cast<void *>(&m_storage)) T(std::forward<F>(f));
+        m_ops = &ops_for<T>;
+    }
+
+    inplace_function(const inplace_function &other) {
+        if (other.m_ops) {
+            other.m_ops->copy(&m_storage, &other.m_storage);
+            m_ops = other.m_ops;
+        }
+    }
+
+    inplace_function(inplace_function &&other) noexcept {
+        if (other.m_ops) {
+            other.m_ops->move(&m_storage, &other.m_storage);
+            m_ops = other.m_ops;
+            other.reset();
+        }
+    }
+
+    ~inplace_function() { reset(); }
+
+    inplace_function &operator=(const inplace_function &other) {
+        if (this != &other) {
+            inplace_function tmp(other);
+            *this = std::move(tmp);
+        }
+        return *this;
+    }
+
+    inplace_function &operator=(inplace_function &&other) noexcept {
+        if (this != &other) {
+            reset();
+            if (other.m_ops) {
+                other.m_ops->move(&m_storage, &other.m_storage);
+                m_ops = other.m_ops;
+                other.reset();
+            }
+        }
+        return *this;
+    }
+
+    inplace_function &operator=(std::nullptr_t) noexcept {
+        reset();
+        return *this;
+    }
+
+    explicit operator bool() const noexcept { return m_ops != nullptr; }
+
+    R operator()(Args ... args) const {
+        if (!m_ops) {
+            throw std::bad_function_call();
+        }
+        return m_ops->invoke(const_cast<storage *>(&m_storage), std::forward<Args>(args)...);
+    }
+
+private:
+    using storage = std::aligned_storage_t<Capacity, Alignment>;
+
+    struct ops {
+        R    (*invoke)(void *, Args && ...);
+        void (*copy)(void *dst, const void *src);
+        void (*move)(void *dst, void *src);
+        void (*destroy)(void *);
+    };
+
+    template <typename T>
+    static constexpr ops ops_for = {
+        [](void *f, Args && ... args) -> R { return (*static_cast<T *>(f))(std::forward<Args>(args)...); },
+        [](void *dst, const void *src) { ::new (dst) T(*static_cast<const T *>(src)); },
+        [](void *dst, void *src) { ::new (dst) T(std::move(*static_cast<T *>(src))); },
+        [](void *f) { static_cast<T *>(f)->~T(); },
+    };
+
+    void reset() noexcept {
+        if (m_ops) {
+            m_ops->destroy(&m_storage);
+            m_ops = nullptr;
+        }
+    }
+
+    storage m_storage;
+    const ops *m_ops = nullptr;
+};
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+/*
+ * bounded lock-free multi-producer single-consumer queue (Vyukov's array
+ * queue with per-cell sequence numbers). producers claim a cell with one
+ * CAS on the tail, the consumer needs no atomic read-modify-write at all.
+ * the cells are allocated once up front, emplace/pop never allocate.
+ *
+ * front()/pop() must only be called from the one consumer thread.
+ */
+template <typename T>
+class mpsc_queue {
+public:
+    explicit mpsc_queue(std::size_t capacity) :
+        m_mask(capacity - 1),
+        m_cells(new cell[capacity])
+    {
+        if (capacity < 2 || (capacity & (capacity - 1)) != 0) {
+            throw std::invalid_argument("mpsc_queue capacity must be a power of two");
+        }
+        for (std::size_t i = 0; i < capacity; ++i) {
+            m_cells[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    mpsc_queue(const mpsc_queue &) = delete;
+    mpsc_queue &operator=(const mpsc_queue &) = delete;
+
+    ~mpsc_queue() {
+        while (front()) {
+            pop();
+        }
+    }
+
+    std::size_t capacity() const { return m_mask + 1; }
+
+    // any thread. false if the queue is full
+    template <typename ... Args>
+    bool emplace(Args && ... args) {
+        std::size_t pos = m_tail.load(std::memory_order_relaxed);
+        cell *c;
+        for (;;) {
+            c = &m_cells[pos & m_mask];
+            const std::size_t seq = c->seq.load(std::memory_order_acquire);
+            const std::intptr_t diff = static_cast<std::intptr_t>(seq) - static_cast<std::intptr_t>(pos);
+            if (diff == 0) {
+                if (m_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = m_tail.load(std::memory_order_relaxed);
+            }
+        }
+
+        ::new (static_cast<void *>(&c->storage)) T(std::forward<Args>(args)...);
+        c->seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // consumer only. nullptr if nothing has been published yet
+    T *front() {
+        const std::size_t head = m_head.load(std::memory_order_relaxed);
+        cell &c = m_cells[head & m_mask];
+        if (c.seq.load(std::memory_order_acquire) != head + 1) {
+            return nullptr;
+        }
+        return std::launder(reinterpret_cast<T *>(&c.storage));
+    }
+
+    // consumer only, after front() returned an element
+    void pop() {
+        const std::size_t head = m_head.load(std::memory_order_relaxed);
+        cell &c = m_cells[head & m_mask];
+        std::launder(reinterpret_cast<T *>(&c.storage))->~T();
+        c.seq.store(head + m_mask + 1, std::memory_order_release);
+        m_head.store(head + 1, std::memory_order_relaxed);
+    }
+
+    // any thread, a snapshot that may be stale by the time it is read
+    std::size_t size_approx() const {
+        const std::size_t tail = m_tail.load(std::memory_order_relaxed);
+        const std::size_t head = m_head.load(std::memory_order_relaxed);
+        return tail > head ? tail - head : 0;
+    }
+
+private:
+    struct cell {
+        std::atomic<std::size_t> seq;
+        std::aligned_storage_t<sizeof(T), alignof(T)> storage;
+    };
+
+    const std::size_t m_mask;
+    std::unique_ptr<cell[]> m_cells;
+
+    // producers and the consumer write different cache lines
+    alignas(64) std::atomic<std::size_t> m_tail{0};
+    alignas(64) std::atomic<std::size_t> m_head{0};
+};
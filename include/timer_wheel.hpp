@@ -0,0 +1,250 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+// list links of a timer_wheel slot
+struct wheel_link {
+    wheel_link *prev = nullptr;
+    wheel_link *next = nullptr;
+};
+
+/*
+ * what a timer_wheel schedules. embed it in the timer object and set
+ * on_expiry; the entry is unlinked before on_expiry runs, so the callback
+ * may schedule it again or destroy it.
+ */
+struct wheel_entry : wheel_link {
+    bool linked() const { return next != nullptr; }
+
+    std::uint64_t expires = 0;                  // in ticks of the wheel
+    void (*on_expiry)(wheel_entry &) = nullptr;
+};
+
+/*
+ * hierarchical timing wheel: four rings of 256 slots, level l holding
+ * the entries due in [256^l, 256^(l + 1)) ticks. scheduling and cancelling
+ * are a list insert and unlink, whatever the number of pending entries;
+ * advance() moves the entries of a higher slot one level down whenever
+ * the lower level completes a rotation, so each entry is touched at most
+ * once per level. a bitmap of the non-empty slots per level lets advance()
+ * skip over empty ticks, so a long idle stretch costs a few steps rather
+ * than one per tick. deadlines beyond the top level are parked in its last
+ * reachable slot and rescheduled from there.
+ *
+ * not thread-safe: a wheel belongs to one thread, e.g. one per shard or
+ * event loop, and entries must be scheduled and cancelled on that thread.
+ * entries still pending when the wheel is destroyed are just unlinked.
+ */
+class timer_wheel {
+public:
+    using clock = std::chrono::steady_clock;
+
+    static constexpr unsigned levels    = 4;
+    static constexpr unsigned slot_bits = 8;
+    static constexpr unsigned slots     = 1u << slot_bits;
+
+    explicit timer_wheel(clock::duration resolution = std::chrono::milliseconds(1),
+                         clock::time_point start = clock::now()) :
+        m_resolution(resolution),
+        m_start(start)
+    {
+        for (auto &level : m_slots) {
+            for (wheel_link &head : level) {
+                head.prev = head.next = &head;
+            }
+        }
+    }
+
+    timer_wheel(const timer_wheel &) = delete;
+    timer_wheel &operator=(const timer_wheel &) = delete;
+
+    ~timer_wheel() {
+        for (auto &level : m_slots) {
+            for (wheel_link &head : level) {
+                while (head.next != &head) {
+                    unlink(*static_cast<wheel_entry *>(head.next));
+                }
+            }
+        }
+    }
+
+    // due after at least `after`, counted from the last advance(). an entry
+    // that is already pending is moved
+    void schedule(wheel_entry &e, clock::duration after) {
+        cancel(e);
+        const auto ticks = (after + m_resolution - clock::duration(1)) / m_resolution;
+        e.expires = m_now + (ticks > 0 ? std::uint64_t(ticks) : 1);
+        insert(e);
+        ++m_pending;
+    }
+
+    // no-op for an entry that is not pending
+    void cancel(wheel_entry &e) {
+        if (e.linked()) {
+            unlink(e);
+            --m_pending;
+        }
+    }
+
+    // fires everything due up to now, returns how many entries expired
+    std::size_t advance(clock::time_point now = clock::now()) {
+        const std::uint64_t target = now > m_start ? std::uint64_t((now - m_start) / m_resolution) : 0;
+        std::size_t fired = 0;
+        while (m_now < target) {
+            // straight to the next tick with a slot to expire or cascade,
+            // the empty ones in between have nothing to do
+            const std::uint64_t next = next_due();
+            if (m_pending == 0 || next > target) {
+                m_now = target;
+                break;
+            }
+            m_now = next;
+
+            // top down, so entries moving down land in slots not yet visited
+            unsigned top = 0;
+            while (top + 1 < levels && (m_now & ((std::uint64_t(1) << (slot_bits * (top + 1))) - 1)) == 0) {
+                ++top;
+            }
+            for (unsigned l = top; l > 0; --l) {
+                cascade(l);
+            }
+            fired += expire(0, m_now & (slots - 1));
+        }
+        return fired;
+    }
+
+    std::size_t pending() const { return m_pending; }
+
+    // ticks since start, as of the last advance()
+    std::uint64_t now() const { return m_now; }
+
+    clock::duration resolution() const { return m_resolution; }
+
+private:
+    static constexpr std::uint64_t horizon = std::uint64_t(1) << (slot_bits * levels);
+
+    void insert(wheel_entry &e) {
+        std::uint64_t when = e.expires;
+        if (when - m_now >= horizon) {
+            when = m_now + horizon - 1;
+        }
+        const std::uint64_t delta = when - m_now;
+        unsigned l = 0;
+        while (l + 1 < levels && delta >= (std::uint64_t(1) << (slot_bits * (l + 1)))) {
+            ++l;
+        }
+        const unsigned slot = (when >> (slot_bits * l)) & (slots - 1);
+        link(m_slots[l][slot], e);
+        m_used[l][slot / 64] |= std::uint64_t(1) << (slot % 64);
+    }
+
+    void cascade(unsigned l) {
+        const unsigned slot = (m_now >> (slot_bits * l)) & (slots - 1);
+        wheel_link &head = m_slots[l][slot];
+        while (head.next != &head) {
+            wheel_entry &e = *static_cast<wheel_entry *>(head.next);
+            unlink(e);
+            insert(e);
+        }
+        m_used[l][slot / 64] &= ~(std::uint64_t(1) << (slot % 64));
+    }
+
+    std::size_t expire(unsigned l, unsigned slot) {
+        // detach the slot first: callbacks may schedule or cancel anything
+        wheel_link &head = m_slots[l][slot];
+        wheel_link due;
+        m_used[l][slot / 64] &= ~(std::uint64_t(1) << (slot % 64));
+        if (head.next == &head) {
+            return 0;
+        }
+        due.next = head.next;
+        due.prev = head.prev;
+        due.next->prev = due.prev->next = &due;
+        head.prev = head.next = &head;
+
+        std::size_t fired = 0;
+        while (due.next != &due) {
+            wheel_entry &e = *static_cast<wheel_entry *>(due.next);
+            unlink(e);
+            --m_pending;
+            ++fired;
+            e.on_expiry(e);
+        }
+        return fired;
+    }
+
+    // the earliest tick after m_now at which a slot of any level is due.
+    // a used slot of level l is due when the ticks below that level wrap to
+    // 0 with the slot current, which is always within one rotation of l
+    std::uint64_t next_due() {
+        std::uint64_t next = ~std::uint64_t(0);
+        for (unsigned l = 0; l < levels; ++l) {
+            const unsigned shift = slot_bits * l;
+            const unsigned distance = next_used(l, (m_now >> shift) & (slots - 1));
+            if (distance != 0) {
+                const std::uint64_t due = ((m_now >> shift) + distance) << shift;
+                next = due < next ? due : next;
+            }
+        }
+        return next;
+    }
+
+    // how many slots after `from` the next non-empty one of level l is,
+    // `from` itself counting as slots; 0 if the level is empty. unlink()
+    // leaves the bit of a slot it empties set, those are cleared here
+    unsigned next_used(unsigned l, unsigned from) {
+        for (unsigned n = 1; n <= slots;) {
+            const unsigned slot = (from + n) & (slots - 1);
+            const std::uint64_t word = m_used[l][slot / 64] >> (slot % 64);
+            if (word == 0) {
+                n += 64 - slot % 64;
+                continue;
+            }
+            n += lowest_bit(word);
+            if (n > slots) {
+                break;
+            }
+            const unsigned hit = (from + n) & (slots - 1);
+            if (m_slots[l][hit].next != &m_slots[l][hit]) {
+                return n;
+            }
+            m_used[l][hit / 64] &= ~(std::uint64_t(1) << (hit % 64));
+            ++n;
+        }
+        return 0;
+    }
+
+    static unsigned lowest_bit(std::uint64_t v) {
+    #if defined(__GNUC__) || defined(__clang__)
+        return unsigned(__builtin_ctzll(v));
+    #else
+        unsigned b = 0;
+        for (; (v & 1) == 0; v >>= 1) {
+            ++b;
+        }
+        return b;
+    #endif
+    }
+
+    static void link(wheel_link &head, wheel_entry &e) {
+        e.prev = head.prev;
+        e.next = &head;
+        head.prev->next = &e;
+        head.prev = &e;
+    }
+
+    static void unlink(wheel_entry &e) {
+        e.prev->next = e.next;
+        e.next->prev = e.prev;
+        e.prev = e.next = nullptr;
+    }
+
+    wheel_link m_slots[levels][slots];
+    std::uint64_t m_used[levels][slots / 64] = {};  // non-empty slots, possibly stale
+    clock::duration m_resolution;
+    clock::time_point m_start;
+    std::uint64_t m_now = 0;
+    std::size_t m_pending = 0;
+};
@@ -1,28 +1,48 @@
-#include <string>
-#include <cxxabi.h>
+#pragma once
+
+#include <string_view>
+#include <type_traits>
+
+/*
+ * compile-time type names: a view into the compiler's own function
+ * signature string, so asking for a name never demangles or allocates.
+ * specialize type_name_trait to give a type a shorter or stable name,
+ *
+ *   template <> struct type_name_trait<connecting> {
+ *       static constexpr std::string_view value = "connecting";
+ *   };
+ */
+namespace detail {
+    template <typename T>
+    constexpr std::string_view signature_type_name()
+    {
+    #if defined(__clang__) || defined(__GNUC__)
+        // "... signature_type_name() [with T = foo; std::string_view = ...]" (gcc)
+        // "... signature_type_name() [T = foo]" (clang)
+        constexpr std::string_view f = __PRETTY_FUNCTION__;
+        constexpr std::size_t begin = f.find("T = ") + 4;
+        constexpr std::size_t semi  = f.find(';', begin);
+        constexpr std::size_t end   = semi != std::string_view::npos ? semi : f.rfind(']');
+    #elif defined(_MSC_VER)
+        // "... detail::signature_type_name<foo>(void)"
+        constexpr std::string_view f = __FUNCSIG__;
+        constexpr std::size_t begin = f.find("signature_type_name<") + 20;
+        constexpr std::size_t end   = f.rfind(">(void)");
+    #else
+    #error "type_name needs __PRETTY_FUNCTION__ or __FUNCSIG__"
+    #endif
+        return f.substr(begin, end - begin);
+    }
+}
 
 template <typename T>
-std::string
+struct type_name_trait {
+    static constexpr std::string_view value = detail::signature_type_name<T>();
+};
+
+template <typename T>
+constexpr std::string_view
 type_name()
 {
-    using TR = typename std::remove_reference<T>::type;
-    std::unique_ptr<char, void(*)(void*)> own (
-    #ifndef _MSC_VER
-        abi::__cxa_demangle (typeid(TR).name(), nullptr,
-            nullptr, nullptr),
-    #else
-            nullptr,
-    #endif
-            std::free
-    );
-    std::string r = own != nullptr ? own.get() : typeid(TR).name();
-    if (std::is_const<TR>::value)
-        r += " const";
-    if (std::is_volatile<TR>::value)
-        r += " volatile";
-    if (std::is_lvalue_reference<T>::value)
-        r += "&";
-    else if (std::is_rvalue_reference<T>::value)
-        r += "&&";
-    return r;
+    return type_name_trait<T>::value;
 }
@@ -5,35 +5,151 @@
 #include <tuple>
 #include <utility>
 #include <type_traits>
+#include <array>
+#include <cstdint>
 #include <cstdio>
 
+// true if T is one of the alternatives of List, e.g. contains_v<int, std::variant<int, char>>
+template <class T, class List>
+struct contains;
+
+template <class T, template <class...> class TT, class... Ts>
+struct contains<T, TT<Ts...>> : std::bool_constant<(... || std::is_same_v<T, Ts>)> {};
+
+template <class T, class List>
+constexpr bool contains_v = contains<T, List>::value;
+
+// number of alternatives in List
+template <class List>
+struct size_of;
+
+template <template <class...> class TT, class... Ts>
+struct size_of<TT<Ts...>> : std::integral_constant<std::size_t, sizeof...(Ts)> {};
+
+template <class List>
+constexpr std::size_t size_of_v = size_of<List>::value;
+
 namespace detail {
-    template <template <class...> class TT, template <class...> class UU, class... Us>
-    auto pack(UU<Us...>)
-    -> std::tuple<TT<Us>...>;
+    template <std::size_t I, class T>
+    struct indexed_type {};
+
+    // one empty base per position, built once per list
+    template <class List, class Is>
+    struct index_map;
+
+    template <template <class...> class TT, class... Ts, std::size_t... Is>
+    struct index_map<TT<Ts...>, std::index_sequence<Is...>> : indexed_type<Is, Ts>... {};
+
+    // deduces I from the one base holding T; fails if T is absent or repeated
+    template <class T, std::size_t I>
+    auto find_index(const indexed_type<I, T> &) -> std::integral_constant<std::size_t, I>;
+
+    template <class T>
+    auto find_index(...) -> void;
+}
+
+// position of T in List, or size_of_v<List> if it is not there. the
+// compiler finds T among the bases of List's index_map, so a lookup costs no
+// instantiation per element; only a T that the map cannot place, absent or
+// repeated, is looked for with a scan
+template <class T, class List>
+struct index_of;
+
+template <class T, template <class...> class TT, class... Ts>
+struct index_of<T, TT<Ts...>> {
+    using found = decltype(detail::find_index<T>(
+        std::declval<const detail::index_map<TT<Ts...>, std::index_sequence_for<Ts...>> &>()));
+
+    static constexpr std::size_t value = [] {
+        if constexpr (!std::is_void_v<found>) {
+            return found::value;
+        } else {
+            constexpr bool same[] = { std::is_same_v<T, Ts>..., false };
+            std::size_t i = 0;
+            while (i < sizeof...(Ts) && !same[i]) {
+                ++i;
+            }
+            return i;
+        }
+    }();
+};
+
+template <class T, class List>
+constexpr std::size_t index_of_v = index_of<T, List>::value;
+
+/*
+ * a list of types, never instantiated. the set operations below go
+ * through it instead of std::tuple: concatenation is a fold over a
+ * declared-only operator+ rather than std::tuple_cat, so a table of a
+ * thousand rows neither recurses a thousand templates deep nor builds a
+ * tuple type per step.
+ */
+template <class... Ts>
+struct type_list {};
+
+namespace detail {
+    template <class... As, class... Bs>
+    auto operator+(type_list<As...>, type_list<Bs...>) -> type_list<As..., Bs...>;
+
+    template <class... Lists>
+    struct concat {
+        using type = decltype((type_list<>() + ... + Lists()));
+    };
+
+    template <class... Lists>
+    using concat_t = typename concat<Lists...>::type;
+
+    template <class List>
+    struct as_list;
 
     template <template <class...> class TT, class... Ts>
-    auto unpack(std::tuple<TT<Ts>...>)
-    -> TT<Ts...>;
+    struct as_list<TT<Ts...>> {
+        using type = type_list<Ts...>;
+    };
+
+    template <template <class...> class TT, class List>
+    struct rebind_list;
 
-    template <std::size_t N, class T>
-    using TET = std::tuple_element_t<N, T>;
+    template <template <class...> class TT, class... Ts>
+    struct rebind_list<TT, type_list<Ts...>> {
+        using type = TT<Ts...>;
+    };
 
-    template <std::size_t N, class T, std::size_t... Is>
-    constexpr auto remove_duplicates_pack_first(T, std::index_sequence<Is...>)
-    -> std::conditional_t<(... || (N > Is && std::is_same_v<TET<N, T>, TET<Is, T>>)), std::tuple<>, std::tuple<TET<N, T>>>;
+    // the distinct types so far as empty bases: whether one more type is
+    // new is a base class lookup the compiler does itself rather than a
+    // comparison with every type seen, one instantiated is_same per pair
+    template <class T>
+    struct type_tag {};
 
-    template <template <class...> class TT, class... Ts, std::size_t... Is>
-    auto remove_duplicates(std::tuple<TT<Ts>...> t, std::index_sequence<Is...> is)
-    -> decltype(std::tuple_cat(remove_duplicates_pack_first<Is>(t, is)...));
+    template <class... Ts>
+    struct type_set : type_tag<Ts>... {
+        using list = type_list<Ts...>;
+    };
+
+    template <class... Ts, class T>
+    auto operator+(type_set<Ts...>, type_tag<T>)
+    -> std::conditional_t<std::is_base_of_v<type_tag<T>, type_set<Ts...>>, type_set<Ts...>, type_set<Ts..., T>>;
+
+    template <class List>
+    struct unique;
 
     template <template <class...> class TT, class... Ts>
-    auto remove_duplicates(TT<Ts...> t)
-    -> decltype(unpack<TT>(remove_duplicates<TT>(pack<TT>(t), std::make_index_sequence<sizeof...(Ts)>())));
+    struct unique<TT<Ts...>> {
+        using type = typename rebind_list<TT, typename decltype((type_set<>() + ... + type_tag<Ts>()))::list>::type;
+    };
 }
 
+// the alternatives of every Ts in order, as one TT
 template <template <class...> class TT, class... Ts>
-using merge_t = decltype(detail::unpack<TT>(std::tuple_cat(detail::pack<TT>(std::declval<Ts>())...)));
+using merge_t = typename detail::rebind_list<TT, detail::concat_t<typename detail::as_list<Ts>::type...>>::type;
 
+// List without repeated alternatives, the first of each kept in place
 template <class T>
-using remove_duplicates_t = decltype(detail::remove_duplicates(std::declval<T>()));
+using remove_duplicates_t = typename detail::unique<T>::type;
+
+// narrowest unsigned type that can hold every value in [0, Max]
+template <std::size_t Max>
+using smallest_unsigned_t =
+    std::conditional_t<(Max <= UINT8_MAX),  std::uint8_t,
+    std::conditional_t<(Max <= UINT16_MAX), std::uint16_t,
+    std::conditional_t<(Max <= UINT32_MAX), std::uint32_t, std::uint64_t>>>;